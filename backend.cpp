@@ -0,0 +1,158 @@
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+/*
+Everything the emulator needs from the host
+present - show one packed 64 x 32 frame (one word per row, bit 63 is the leftmost pixel)
+input   - poll host input into keymask, returns true when the user asked to quit
+audio   - turn the buzzer on or off
+platform (SDL) is the interactive backend, the ones below run without a display
+*/
+
+//emulator hotkeys raised by input, the main loop clears the bits it handled
+const uint32_t HOTKEY_SCREENSHOT= 1u<< 0;
+const uint32_t HOTKEY_CLIP= 1u<< 1;
+const uint32_t HOTKEY_TURBO= 1u<< 2;
+const uint32_t HOTKEY_SAVE_STATE= 1u<< 3;
+const uint32_t HOTKEY_LOAD_STATE= 1u<< 4;
+
+class backend{
+    public:
+        virtual ~backend(){}
+        virtual void present(uint64_t const* rows)= 0;
+        virtual bool input()= 0;
+        virtual void audio(bool tone)= 0;
+
+        uint32_t hotkeys{};
+        atomic<uint16_t> keymask{}; //held CHIP-8 keys, bit n is key n, written by input and read by the emulation
+        atomic<bool> rewindHeld{}; //the rewind key is down, the emulation steps back while it is
+};
+
+//headless, throws every frame away so the core runs at full speed
+class nullBackend: public backend{
+    public:
+        void present(uint64_t const*) override{}
+        bool input() override{ return false; }
+        void audio(bool) override{}
+};
+
+//headless, appends every frame to a file as a binary PBM image
+//the frames can be split or viewed with netpbm/ffmpeg
+class fileBackend: public backend{
+    public:
+        fileBackend(char const* fileName);
+        void present(uint64_t const* rows) override;
+        bool input() override{ return false; }
+        void audio(bool) override{}
+
+    private:
+        ofstream file;
+};
+
+fileBackend::fileBackend(char const* fileName): file(fileName, ios::binary){
+    if(!file.is_open()){
+        cerr<<"Could not open "<<fileName<<" for writing\n";
+    }
+}
+
+void fileBackend::present(uint64_t const* rows){
+    //P4 rows are MSB first like the packed display, but 1 means black
+    uint8_t image[32* 8];
+    for(int y= 0; y< 32; y++){
+        uint64_t bits= ~rows[y];
+        for(int byte= 0; byte< 8; byte++){
+            image[y* 8+ byte]= (bits>> (56- byte* 8)) & 0xFFu;
+        }
+    }
+
+    file<<"P4\n64 32\n";
+    file.write((char const*)image, sizeof(image));
+}
+
+/*
+Draws the display in a terminal with Unicode half blocks, one character cell is two pixels stacked
+Only cells that changed since the last frame are written, cursor addressing escapes skip the rest,
+and the whole frame goes out in one write
+*/
+class termBackend: public backend{
+    public:
+        termBackend();
+        ~termBackend();
+        void present(uint64_t const* rows) override;
+        bool input() override{ return false; }
+        void audio(bool) override{}
+
+        uint64_t bytesWritten{};
+        uint64_t framesWritten{};
+
+    private:
+        void put(char const* text, int len);
+
+        uint64_t previous[32]{};
+        bool first= true;
+        char buffer[64* 16* 16+ 64]; //worst case every cell with its own cursor move
+        int used{};
+};
+
+termBackend::termBackend(){
+    //clear and hide the cursor
+    fputs("\x1b[2J\x1b[?25l", stdout);
+    fflush(stdout);
+}
+
+termBackend::~termBackend(){
+    //park the cursor under the picture and show it again
+    fputs("\x1b[17;1H\x1b[?25h", stdout);
+    fflush(stdout);
+    if(framesWritten> 0){
+        cerr<<"Terminal: "<<bytesWritten/ framesWritten<<" bytes per frame on average\n";
+    }
+}
+
+void termBackend::put(char const* text, int len){
+    memcpy(buffer+ used, text, len);
+    used+= len;
+}
+
+void termBackend::present(uint64_t const* rows){
+    //indexed by top pixel + 2 * bottom pixel
+    static char const* cells[4]= {" ", "\xE2\x96\x80", "\xE2\x96\x84", "\xE2\x96\x88"};
+    used= 0;
+    int cursorRow= -1, cursorCol= -1;
+
+    for(int cy= 0; cy< 16; cy++){
+        uint64_t top= rows[cy* 2];
+        uint64_t bottom= rows[cy* 2+ 1];
+        uint64_t changed= first? ~0ull: (top^ previous[cy* 2]) | (bottom^ previous[cy* 2+ 1]);
+
+        while(changed){
+            int x= __builtin_clzll(changed);
+            changed&= ~(1ull<< (63- x));
+
+            if(cursorRow!= cy|| cursorCol!= x){
+                char move[16];
+                put(move, snprintf(move, sizeof(move), "\x1b[%d;%dH", cy+ 1, x+ 1));
+            }
+            int cell= ((top>> (63- x)) & 1u) | (((bottom>> (63- x)) & 1u)<< 1);
+            put(cells[cell], cell? 3: 1);
+            cursorRow= cy;
+            cursorCol= x+ 1;
+        }
+    }
+
+    memcpy(previous, rows, sizeof(previous));
+    first= false;
+    if(used> 0){
+        fwrite(buffer, 1, used, stdout);
+        fflush(stdout);
+    }
+    bytesWritten+= used;
+    framesWritten++;
+}
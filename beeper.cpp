@@ -0,0 +1,291 @@
+#include "src/include/SDL2/SDL.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+const int AUDIO_RATE= 48000;
+const int DEFAULT_AUDIO_BUFFER= 512; //samples, about 10.7 ms at 48 kHz
+const uint32_t TONE_RING_SIZE= 64;
+const uint32_t SAMPLE_RING_SIZE= 8192; //streamed samples, about 170 ms
+const int FRAME_SAMPLES= AUDIO_RATE/ 60; //samples per emulated frame
+const double MAX_RATE_ADJUST= 0.005; //the audio clock moves the frame rate by at most 0.5%
+
+/*
+Buzzer output on its own SDL audio callback thread
+The emulation thread posts tone on/off events into a lock-free single producer / single consumer ring,
+the callback drains it at the start of every block and synthesises a band-limited (PolyBLEP) square wave
+The callback never waits on emulation and emulation never waits on the callback,
+if emulation stalls the callback just keeps playing the last state
+Latency is measured from the emulated frame where Fx18 started the tone (markTone, called as the sound timer
+leaves 0) to the moment the tone reaches the device, including presenting, the ring and the block being filled
+
+Streamed (audio clock) mode instead has the emulation synthesise FRAME_SAMPLES per frame into a sample ring
+that the callback only copies out, so the device consumes emulated time at its own clock
+rateAdjust tells the scheduler how much faster or slower to run to hold the ring at its target fill,
+underruns and the latency the ring adds are measured
+*/
+class beeper{
+    public:
+        beeper(int bufferSamples, float frequency, bool streamed);
+        ~beeper();
+        bool isOpen() const{ return device!= 0; }
+        void markTone();
+        void post(bool on);
+        void queue(bool on, int count);
+        double rateAdjust();
+        void report() const;
+
+        //measurements, written by the callback
+        atomic<uint64_t> latencySamples{};
+        atomic<uint64_t> latencyTotalMicros{};
+        atomic<uint64_t> latencyMaxMicros{};
+        atomic<uint64_t> blocks{};
+        atomic<uint64_t> dropped{}; //events lost because the ring was full
+
+        //streamed mode
+        atomic<uint64_t> underruns{}; //blocks the ring could not fill
+        atomic<uint64_t> overflowed{}; //samples lost because the ring was full
+        double minRate= 1.0;
+        double maxRate= 1.0;
+
+    private:
+        struct toneEvent{
+            bool on;
+            int64_t startedNanos; //steady clock, when the emulation started the tone, or the post if it was not marked
+        };
+
+        static void SDLCALL callback(void* user, Uint8* stream, int len);
+        void fill(int16_t* out, int samples);
+        int16_t nextSample();
+
+        SDL_AudioDeviceID device{};
+        int bufferSamples;
+        double phaseStep;
+        bool streamed;
+        int targetFill; //samples kept queued in streamed mode
+
+        toneEvent ring[TONE_RING_SIZE];
+        atomic<uint32_t> head{};
+        atomic<uint32_t> tail{};
+
+        int16_t samples[SAMPLE_RING_SIZE];
+        atomic<uint32_t> sampleHead{};
+        atomic<uint32_t> sampleTail{};
+        atomic<bool> started{}; //no underruns are counted before the first queue
+        atomic<int64_t> markedNanos{}; //steady clock of the last markTone not posted yet, 0 if none
+
+        //synthesis state, callback thread only or emulation thread only when streamed
+        bool toneOn{};
+        double phase{};
+        float gain{}; //ramps towards toneOn to avoid clicks
+};
+
+beeper::beeper(int bufferSamples, float frequency, bool streamed): bufferSamples(bufferSamples> 0? bufferSamples: DEFAULT_AUDIO_BUFFER), streamed(streamed){
+    phaseStep= frequency/ AUDIO_RATE;
+
+    if(SDL_InitSubSystem(SDL_INIT_AUDIO)!= 0){
+        cerr<<"Audio init failed: "<<SDL_GetError()<<"\n";
+        return;
+    }
+
+    SDL_AudioSpec want{};
+    SDL_AudioSpec have{};
+    want.freq= AUDIO_RATE;
+    want.format= AUDIO_S16SYS;
+    want.channels= 1;
+    want.samples= this->bufferSamples;
+    want.callback= &beeper::callback;
+    want.userdata= this;
+
+    device= SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0);
+    if(device== 0){
+        cerr<<"Could not open audio: "<<SDL_GetError()<<"\n";
+        return;
+    }
+    this->bufferSamples= have.samples;
+    //one device block plus one frame, the least that survives a frame arriving just after a block
+    targetFill= this->bufferSamples+ FRAME_SAMPLES;
+    SDL_PauseAudioDevice(device, 0);
+}
+
+beeper::~beeper(){
+    if(device!= 0){
+        SDL_CloseAudioDevice(device);
+    }
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+}
+
+//emulation side: the frame just run took the sound timer from 0 to running, the next tone on is timed from here
+void beeper::markTone(){
+    markedNanos.store(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count(), memory_order_relaxed);
+}
+
+//present side, never blocks
+void beeper::post(bool on){
+    int64_t now= chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t marked= on? markedNanos.exchange(0, memory_order_relaxed): 0;
+
+    uint32_t h= head.load(memory_order_relaxed);
+    if(h- tail.load(memory_order_acquire)>= TONE_RING_SIZE){
+        dropped.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+
+    ring[h% TONE_RING_SIZE].on= on;
+    ring[h% TONE_RING_SIZE].startedNanos= marked> 0? marked: now;
+    head.store(h+ 1, memory_order_release);
+}
+
+void SDLCALL beeper::callback(void* user, Uint8* stream, int len){
+    ((beeper*)user)->fill((int16_t*)stream, len/ (int)sizeof(int16_t));
+}
+
+//PolyBLEP residual, smooths the step at t= 0 over one sample on each side
+double polyBLEP(double t, double dt){
+    if(t< dt){
+        t/= dt;
+        return t+ t- t* t- 1.0;
+    }
+    if(t> 1.0- dt){
+        t= (t- 1.0)/ dt;
+        return t* t+ t+ t+ 1.0;
+    }
+    return 0.0;
+}
+
+//one sample of the band-limited square wave, ramping the gain towards toneOn
+int16_t beeper::nextSample(){
+    const float amplitude= 0.2f* 32767.0f;
+    const float ramp= 1.0f/ 64.0f;
+
+    double value= phase< 0.5? 1.0: -1.0;
+    value+= polyBLEP(phase, phaseStep);
+    value-= polyBLEP(fmod(phase+ 0.5, 1.0), phaseStep);
+
+    phase+= phaseStep;
+    if(phase>= 1.0){
+        phase-= 1.0;
+    }
+
+    if(toneOn&& gain< 1.0f){
+        gain= gain+ ramp> 1.0f? 1.0f: gain+ ramp;
+    }else if(!toneOn&& gain> 0.0f){
+        gain= gain- ramp< 0.0f? 0.0f: gain- ramp;
+    }
+    return (int16_t)(value* amplitude* gain);
+}
+
+void beeper::fill(int16_t* out, int count){
+    blocks.fetch_add(1, memory_order_relaxed);
+
+    if(streamed){
+        //copy out what the emulation queued, a short ring is padded with silence
+        uint32_t t= sampleTail.load(memory_order_relaxed);
+        uint32_t available= sampleHead.load(memory_order_acquire)- t;
+        int copied= available< (uint32_t)count? (int)available: count;
+        for(int i= 0; i< copied; i++){
+            out[i]= samples[(t+ i)% SAMPLE_RING_SIZE];
+        }
+        sampleTail.store(t+ copied, memory_order_release);
+
+        if(copied< count){
+            memset(out+ copied, 0, (count- copied)* sizeof(int16_t));
+            if(started.load(memory_order_relaxed)){
+                underruns.fetch_add(1, memory_order_relaxed);
+            }
+        }
+        return;
+    }
+
+    //drain the ring, only the newest state matters for this block
+    int64_t now= chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    uint32_t t= tail.load(memory_order_relaxed);
+    uint32_t h= head.load(memory_order_acquire);
+
+    for(; t!= h; t++){
+        toneEvent const& event= ring[t% TONE_RING_SIZE];
+        if(event.on&& !toneOn){
+            //waited in the ring, then plays after the block already queued in the device
+            uint64_t micros= (now- event.startedNanos)/ 1000+ (uint64_t)bufferSamples* 1000000/ AUDIO_RATE;
+            latencySamples.fetch_add(1, memory_order_relaxed);
+            latencyTotalMicros.fetch_add(micros, memory_order_relaxed);
+            if(micros> latencyMaxMicros.load(memory_order_relaxed)){
+                latencyMaxMicros.store(micros, memory_order_relaxed);
+            }
+        }
+        toneOn= event.on;
+    }
+    tail.store(t, memory_order_release);
+
+    //synthesise the block
+    for(int i= 0; i< count; i++){
+        out[i]= nextSample();
+    }
+}
+
+//streamed mode, emulation side: one frame's worth of samples at the frame's tone state
+void beeper::queue(bool on, int count){
+    uint32_t h= sampleHead.load(memory_order_relaxed);
+    uint32_t queued= h- sampleTail.load(memory_order_acquire);
+
+    //what the ring adds on top of the device block, seen by the first of these samples
+    uint64_t micros= ((uint64_t)queued+ bufferSamples)* 1000000/ AUDIO_RATE;
+    latencySamples.fetch_add(1, memory_order_relaxed);
+    latencyTotalMicros.fetch_add(micros, memory_order_relaxed);
+    if(micros> latencyMaxMicros.load(memory_order_relaxed)){
+        latencyMaxMicros.store(micros, memory_order_relaxed);
+    }
+
+    if(queued+ count> SAMPLE_RING_SIZE){
+        overflowed.fetch_add(queued+ count- SAMPLE_RING_SIZE, memory_order_relaxed);
+        count= SAMPLE_RING_SIZE- queued;
+    }
+
+    toneOn= on;
+    for(int i= 0; i< count; i++){
+        samples[(h+ i)% SAMPLE_RING_SIZE]= nextSample();
+    }
+    sampleHead.store(h+ count, memory_order_release);
+    started.store(true, memory_order_relaxed);
+}
+
+//frame rate multiplier that pulls the ring back to its target fill, proportional and clamped
+double beeper::rateAdjust(){
+    uint32_t queued= sampleHead.load(memory_order_relaxed)- sampleTail.load(memory_order_acquire);
+    double error= (double)((int)targetFill- (int)queued)/ targetFill;
+    if(error> 1.0){
+        error= 1.0;
+    }else if(error< -1.0){
+        error= -1.0;
+    }
+
+    double rate= 1.0+ MAX_RATE_ADJUST* error;
+    minRate= rate< minRate? rate: minRate;
+    maxRate= rate> maxRate? rate: maxRate;
+    return rate;
+}
+
+void beeper::report() const{
+    uint64_t count= latencySamples.load();
+    if(streamed&& count> 0){
+        cerr<<"Audio clock: queue latency avg "<<latencyTotalMicros.load()/ count/ 1000.0<<" ms, max "
+            <<latencyMaxMicros.load()/ 1000.0<<" ms, target "<<targetFill* 1000.0/ AUDIO_RATE<<" ms, "
+            <<underruns.load()<<" underruns, rate "<<minRate<<" to "<<maxRate;
+        if(overflowed.load()> 0){
+            cerr<<", "<<overflowed.load()<<" samples overflowed";
+        }
+        cerr<<"\n";
+    }else if(count> 0){
+        cerr<<"Audio: "<<count<<" tones, latency avg "<<latencyTotalMicros.load()/ count/ 1000.0<<" ms, max "
+            <<latencyMaxMicros.load()/ 1000.0<<" ms, buffer "<<bufferSamples<<" samples";
+        if(dropped.load()> 0){
+            cerr<<", "<<dropped.load()<<" events dropped";
+        }
+        cerr<<"\n";
+    }
+}
@@ -0,0 +1,442 @@
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/*
+PNG screenshots and animated GIF clips of the display
+The caller hands over packed frames by value, a worker thread does all of the encoding and file I/O
+Both formats use the 1-bit nature of the display:
+        PNG - 1-bit greyscale, stored deflate blocks (a frame is only a few hundred bytes anyway)
+        GIF - 2 colour palette, each frame only carries the rectangle that changed since the last one,
+              unchanged frames just extend the delay of the previous one
+*/
+class capture{
+    public:
+        capture(int scale);
+        ~capture();
+
+        void screenshot(uint64_t const* rows, string const& fileName);
+        void beginClip(string const& fileName);
+        void addFrame(uint64_t const* rows);
+        void endClip();
+        bool recording() const{ return clipActive; }
+
+    private:
+        enum jobType{
+            JOB_SCREENSHOT,
+            JOB_CLIP_BEGIN,
+            JOB_CLIP_FRAME,
+            JOB_CLIP_END,
+            JOB_STOP
+        };
+
+        struct job{
+            jobType type;
+            uint64_t rows[32];
+            string fileName;
+        };
+
+        void post(job const& j);
+        void workerLoop();
+
+        //encoders, only run on the worker
+        void writePNG(uint64_t const* rows, string const& fileName);
+        void gifBegin(string const& fileName);
+        void gifFrame(uint64_t const* rows);
+        void gifFlush();
+        void gifEnd();
+        void gifLZW(int left, int top, int width, int height);
+
+        bool pixel(uint64_t const* rows, int x, int y) const{
+            return (rows[y/ scale]>> (63- x/ scale)) & 1u;
+        }
+
+        int scale;
+        bool clipActive{}; //caller side view of the clip state
+
+        mutex lock;
+        condition_variable wake;
+        deque<job> jobs;
+        thread worker;
+
+        //GIF state
+        FILE* gif{};
+        uint64_t gifPrev[32]{}; //last frame written
+        uint64_t gifPending[32]{}; //frame waiting for its delay to be known
+        bool gifHasPending{};
+        bool gifFirst{};
+        int gifDelayFrames{};
+        int gifTime{}; //centiseconds written so far, keeps 60 fps delays from drifting
+        int gifFrames{};
+};
+
+capture::capture(int scale): scale(scale< 1? 1: scale){
+    worker= thread(&capture::workerLoop, this);
+}
+
+capture::~capture(){
+    if(clipActive){
+        endClip();
+    }
+    job stop{};
+    stop.type= JOB_STOP;
+    post(stop);
+    worker.join();
+}
+
+void capture::post(job const& j){
+    {
+        lock_guard<mutex> guard(lock);
+        jobs.push_back(j);
+    }
+    wake.notify_one();
+}
+
+void capture::screenshot(uint64_t const* rows, string const& fileName){
+    job j{};
+    j.type= JOB_SCREENSHOT;
+    memcpy(j.rows, rows, sizeof(j.rows));
+    j.fileName= fileName;
+    post(j);
+}
+
+void capture::beginClip(string const& fileName){
+    job j{};
+    j.type= JOB_CLIP_BEGIN;
+    j.fileName= fileName;
+    post(j);
+    clipActive= true;
+}
+
+//call once per emulated frame while a clip is running, the GIF delays assume 60 fps
+void capture::addFrame(uint64_t const* rows){
+    if(!clipActive){
+        return;
+    }
+    job j{};
+    j.type= JOB_CLIP_FRAME;
+    memcpy(j.rows, rows, sizeof(j.rows));
+    post(j);
+}
+
+void capture::endClip(){
+    job j{};
+    j.type= JOB_CLIP_END;
+    post(j);
+    clipActive= false;
+}
+
+void capture::workerLoop(){
+    while(true){
+        job j;
+        {
+            unique_lock<mutex> guard(lock);
+            wake.wait(guard, [this]{ return !jobs.empty(); });
+            j= move(jobs.front());
+            jobs.pop_front();
+        }
+
+        switch(j.type){
+            case JOB_SCREENSHOT:{
+                writePNG(j.rows, j.fileName);
+            } break;
+
+            case JOB_CLIP_BEGIN:{
+                gifBegin(j.fileName);
+            } break;
+
+            case JOB_CLIP_FRAME:{
+                gifFrame(j.rows);
+            } break;
+
+            case JOB_CLIP_END:{
+                gifEnd();
+            } break;
+
+            case JOB_STOP:{
+                return;
+            }
+        }
+    }
+}
+
+//PNG
+
+uint32_t crc32(uint8_t const* data, size_t size, uint32_t crc= 0){
+    static uint32_t table[256];
+    static bool ready= false;
+    if(!ready){
+        for(uint32_t n= 0; n< 256; n++){
+            uint32_t c= n;
+            for(int k= 0; k< 8; k++){
+                c= (c& 1)? 0xEDB88320u^ (c>> 1): c>> 1;
+            }
+            table[n]= c;
+        }
+        ready= true;
+    }
+
+    crc= ~crc;
+    for(size_t i= 0; i< size; i++){
+        crc= table[(crc^ data[i]) & 0xFFu]^ (crc>> 8);
+    }
+    return ~crc;
+}
+
+void putBE32(vector<uint8_t>& out, uint32_t value){
+    out.push_back(value>> 24);
+    out.push_back(value>> 16);
+    out.push_back(value>> 8);
+    out.push_back(value);
+}
+
+void writeChunk(FILE* file, char const* type, vector<uint8_t> const& data){
+    vector<uint8_t> chunk;
+    putBE32(chunk, data.size());
+    chunk.insert(chunk.end(), type, type+ 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    putBE32(chunk, crc32(&chunk[4], chunk.size()- 4));
+    fwrite(chunk.data(), 1, chunk.size(), file);
+}
+
+void capture::writePNG(uint64_t const* rows, string const& fileName){
+    FILE* file= fopen(fileName.c_str(), "wb");
+    if(!file){
+        cerr<<"Could not write "<<fileName<<"\n";
+        return;
+    }
+
+    uint32_t width= 64* scale;
+    uint32_t height= 32* scale;
+    uint32_t rowBytes= 1+ (width+ 7)/ 8; //filter byte then the 1-bit pixels
+
+    //raw scanlines
+    vector<uint8_t> raw(rowBytes* height, 0);
+    for(uint32_t y= 0; y< height; y++){
+        uint8_t* line= &raw[y* rowBytes+ 1];
+        for(uint32_t x= 0; x< width; x++){
+            if(pixel(rows, x, y)){
+                line[x/ 8]|= 0x80u>> (x% 8);
+            }
+        }
+    }
+
+    //zlib stream made of stored deflate blocks
+    vector<uint8_t> zlib= {0x78, 0x01};
+    uint32_t a= 1, b= 0;
+    for(size_t pos= 0; pos< raw.size() || pos== 0; ){
+        size_t len= raw.size()- pos< 65535? raw.size()- pos: 65535;
+        bool last= pos+ len== raw.size();
+        zlib.push_back(last? 1: 0);
+        zlib.push_back(len& 0xFF);
+        zlib.push_back(len>> 8);
+        zlib.push_back(~len& 0xFF);
+        zlib.push_back((~len>> 8) & 0xFF);
+        for(size_t i= 0; i< len; i++){
+            uint8_t v= raw[pos+ i];
+            zlib.push_back(v);
+            a= (a+ v)% 65521;
+            b= (b+ a)% 65521;
+        }
+        pos+= len;
+        if(last){
+            break;
+        }
+    }
+    putBE32(zlib, (b<< 16) | a);
+
+    static const uint8_t signature[8]= {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    fwrite(signature, 1, 8, file);
+
+    vector<uint8_t> header;
+    putBE32(header, width);
+    putBE32(header, height);
+    header.push_back(1); //bit depth
+    header.push_back(0); //greyscale
+    header.push_back(0); //deflate
+    header.push_back(0); //adaptive filtering
+    header.push_back(0); //no interlace
+    writeChunk(file, "IHDR", header);
+    writeChunk(file, "IDAT", zlib);
+    writeChunk(file, "IEND", {});
+    fclose(file);
+}
+
+//GIF
+
+void capture::gifBegin(string const& fileName){
+    if(gif){
+        gifEnd();
+    }
+    gif= fopen(fileName.c_str(), "wb");
+    if(!gif){
+        cerr<<"Could not write "<<fileName<<"\n";
+        return;
+    }
+
+    uint16_t width= 64* scale;
+    uint16_t height= 32* scale;
+    uint8_t header[]= {
+        'G', 'I', 'F', '8', '9', 'a',
+        (uint8_t)width, (uint8_t)(width>> 8), (uint8_t)height, (uint8_t)(height>> 8),
+        0x80, 0, 0, //global colour table of 2 entries
+        0x00, 0x00, 0x00, //black
+        0xFF, 0xFF, 0xFF, //white
+        0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0', 3, 1, 0, 0, 0 //loop forever
+    };
+    fwrite(header, 1, sizeof(header), gif);
+
+    gifHasPending= false;
+    gifFirst= true;
+    gifDelayFrames= 0;
+    gifTime= 0;
+    gifFrames= 0;
+    memset(gifPrev, 0, sizeof(gifPrev));
+}
+
+void capture::gifFrame(uint64_t const* rows){
+    if(!gif){
+        return;
+    }
+
+    //identical frames only make the pending one last longer
+    if(gifHasPending&& memcmp(rows, gifPending, sizeof(gifPending))== 0){
+        gifDelayFrames++;
+        return;
+    }
+    gifFlush();
+    memcpy(gifPending, rows, sizeof(gifPending));
+    gifHasPending= true;
+    gifDelayFrames= 1;
+}
+
+//writes the pending frame as the rectangle that differs from the previous written frame
+void capture::gifFlush(){
+    if(!gifHasPending){
+        return;
+    }
+
+    int top= 32, bottom= -1;
+    uint64_t changed= 0;
+    for(int y= 0; y< 32; y++){
+        uint64_t diff= gifFirst? ~0ull: gifPending[y]^ gifPrev[y];
+        if(diff){
+            top= y< top? y: top;
+            bottom= y;
+            changed|= diff;
+        }
+    }
+    if(bottom< 0){
+        //nothing changed, still needs a frame to carry the delay
+        top= bottom= 0;
+        changed= 1ull<< 63;
+    }
+    int left= __builtin_clzll(changed);
+    int right= 63- __builtin_ctzll(changed);
+
+    //60 fps in centiseconds, rounded against the running total
+    int frameStart= gifTime;
+    gifFrames+= gifDelayFrames;
+    gifTime= (gifFrames* 100+ 30)/ 60;
+    int delay= gifTime- frameStart;
+
+    uint8_t control[]= {0x21, 0xF9, 4, 0x04, (uint8_t)delay, (uint8_t)(delay>> 8), 0, 0}; //keep previous frame underneath
+    fwrite(control, 1, sizeof(control), gif);
+
+    gifLZW(left* scale, top* scale, (right- left+ 1)* scale, (bottom- top+ 1)* scale);
+
+    memcpy(gifPrev, gifPending, sizeof(gifPrev));
+    gifFirst= false;
+    gifHasPending= false;
+}
+
+//image descriptor plus LZW coded pixels, 2 colours use the minimum code size of 2
+void capture::gifLZW(int left, int top, int width, int height){
+    uint8_t descriptor[]= {0x2C,
+        (uint8_t)left, (uint8_t)(left>> 8), (uint8_t)top, (uint8_t)(top>> 8),
+        (uint8_t)width, (uint8_t)(width>> 8), (uint8_t)height, (uint8_t)(height>> 8), 0, 2};
+    fwrite(descriptor, 1, sizeof(descriptor), gif);
+
+    const int clearCode= 4;
+    const int endCode= 5;
+    static uint16_t next[4096][2]; //dictionary, child code for each (code, pixel)
+
+    vector<uint8_t> out;
+    uint32_t bitBuffer= 0;
+    int bitCount= 0;
+    int codeSize= 3;
+    int nextCode= 6;
+
+    auto emit= [&](int code){
+        bitBuffer|= (uint32_t)code<< bitCount;
+        bitCount+= codeSize;
+        while(bitCount>= 8){
+            out.push_back(bitBuffer& 0xFF);
+            bitBuffer>>= 8;
+            bitCount-= 8;
+        }
+    };
+
+    memset(next, 0, sizeof(next));
+    emit(clearCode);
+
+    int current= -1;
+    for(int y= top; y< top+ height; y++){
+        for(int x= left; x< left+ width; x++){
+            int p= pixel(gifPending, x, y);
+            if(current< 0){
+                current= p;
+                continue;
+            }
+            if(next[current][p]){
+                current= next[current][p];
+                continue;
+            }
+
+            emit(current);
+            next[current][p]= nextCode++;
+            if(nextCode- 1== (1<< codeSize) && codeSize< 12){
+                codeSize++;
+            }
+            if(nextCode== 4096){
+                emit(clearCode);
+                memset(next, 0, sizeof(next));
+                codeSize= 3;
+                nextCode= 6;
+            }
+            current= p;
+        }
+    }
+    emit(current);
+    emit(endCode);
+    if(bitCount> 0){
+        out.push_back(bitBuffer& 0xFF);
+    }
+
+    //data sub-blocks of at most 255 bytes
+    for(size_t pos= 0; pos< out.size(); pos+= 255){
+        uint8_t len= out.size()- pos< 255? out.size()- pos: 255;
+        fputc(len, gif);
+        fwrite(&out[pos], 1, len, gif);
+    }
+    fputc(0, gif);
+}
+
+void capture::gifEnd(){
+    if(!gif){
+        return;
+    }
+    gifFlush();
+    fputc(0x3B, gif);
+    fclose(gif);
+    gif= nullptr;
+}
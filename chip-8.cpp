@@ -5,7 +5,9 @@
 #include <iostream>
 #include <cstdint>
 #include <fstream>
-#include <random>
+#include <functional>
+#include <type_traits>
+#include <vector>
 
 using namespace std;
 
@@ -16,43 +18,119 @@ using namespace std;
 //Fonts are loaded into memory starting at 0x50
 const unsigned int START_ADDRESS= 0x200;
 const unsigned int START_ADDRESS_FONTS= 0x50;
+const unsigned int VIDEO_WIDTH= 64;
+const unsigned int VIDEO_HEIGHT= 32;
+
+//quirk bits, 0 is the original COSMAC VIP behaviour
+const uint8_t QUIRK_WRAP_SPRITES= 0x01; //sprites wrap around the screen edges instead of being clipped
+const uint8_t QUIRKS_KNOWN= QUIRK_WRAP_SPRITES;
+
+//handed to frame observers when a frame changed the display
+struct frameChange{
+    uint64_t frame; //frame number, counted by endFrame
+    uint32_t rows; //one bit per row drawn to during the frame
+    int firstRow; //dirty range, inclusive
+    int lastRow;
+    uint64_t const* display; //read only view of the packed display
+};
+
+typedef function<void(frameChange const&)> frameObserver;
+
+/*
+Everything that decides what the machine does next, kept plain data so a snapshot is one copy
+Run-ahead, and anything else that rolls the machine back, saves and restores this and nothing else
+*/
+struct chip8State{
+    //components of the Chip-8
+    uint8_t registers[16]{}; //16 8-bit registers
+    uint8_t memory[4096]{}; //4k bytes of memory
+    uint16_t index{}; //16-bit index register
+    uint16_t pc{}; //16-bit program counter
+    uint16_t stack[16]{}; //16 level stack
+    uint8_t sp{}; //8-bit stack pointer
+    uint8_t delayTimer{}; //8-bit delay timer
+    uint8_t soundTimer{}; //8-bit sound timer
+    uint8_t quirks{}; //QUIRK_ bits, 0 is the original COSMAC VIP behaviour
+    uint16_t keypad{}; //16 input keys, bit n is key n
+    uint64_t display[32]{}; //64 x 32 output packed one row per word, bit 63 is the leftmost pixel
+    uint16_t opcode{}; //for opcodes (instructions)
+    uint32_t rngState{}; //xorshift32 state for Cxkk, never 0
+    uint32_t dirtyRows= 0xFFFFFFFF; //display rows drawn to since the hash was last updated, one bit per row
+    uint32_t frameRows{}; //display rows drawn to since the last endFrame
+    uint64_t frameCount{};
+
+    //cached display hash, kept per row so only dirty rows are hashed again
+    uint64_t rowHash[32]{};
+    uint64_t screenHash{};
+
+    /*
+    Registers are labeled V0 - VF for the 16 registers available
+    As they are 8-bit, they can hold values from 0x00 - 0xFF
+    Register VF is used to hold flag values for instructions
+    */
+    /*
+    How the 4k bytes of memory are allocated
+    0x000 - 0x1FF: Not used in coded interpretors as this is where the interpretor was held in the actual CHIP-8
+    0x050 - 0x0A0: Storage area for fontset
+    0x200 - 0xFFF: Space for instructions
+    */
+};
+
+/*
+Save state file layout, version 1, little endian
+ 0  magic "C8SS"
+ 4  uint16 version
+ 6  uint16 header size
+ 8  uint32 state size
+12  uint32 reserved, 0
+16  chip8State as laid out below, a save is one copy and a load is a header check and one copy
+Anything that moves a field must bump SAVE_STATE_VERSION, the asserts catch it
+*/
+struct saveHeader{
+    char magic[4];
+    uint16_t version;
+    uint16_t headerSize;
+    uint32_t stateSize;
+    uint32_t reserved;
+};
 
-class chip8{
+const uint16_t SAVE_STATE_VERSION= 1;
+const size_t SAVE_STATE_SIZE= sizeof(saveHeader)+ sizeof(chip8State);
+
+static_assert(sizeof(saveHeader)== 16, "save header layout changed");
+static_assert(offsetof(chip8State, memory)== 16 && offsetof(chip8State, index)== 4112 && offsetof(chip8State, stack)== 4116, "save state layout changed");
+static_assert(offsetof(chip8State, quirks)== 4151 && offsetof(chip8State, keypad)== 4152 && offsetof(chip8State, display)== 4160, "save state layout changed");
+static_assert(offsetof(chip8State, rngState)== 4420 && offsetof(chip8State, rowHash)== 4440 && sizeof(chip8State)== 4704, "save state layout changed");
+static_assert(is_trivially_copyable<chip8State>::value, "save states and clones copy chip8State as bytes");
+
+class chip8: public chip8State{
     public:
         //functions
         chip8();
+        explicit chip8(chip8State const& state);
+        chip8 clone() const;
         void loadROM(char const* fileName);
         void FDEcycle();
-
-        default_random_engine rando;
-        uniform_int_distribution<> randNum;
-
-        //components of the Chip-8
-        uint8_t registers[16]{}; //16 8-bit registers
-        uint8_t memory[4096]{}; //4k bytes of memory
-        uint16_t index{}; //16-bit index register
-        uint16_t pc{}; //16-bit program counter
-        uint16_t stack[16]{}; //16 level stack
-        uint8_t sp{}; //8-bit stack pointer
-        uint8_t delayTimer{}; //8-bit delay timer
-        uint8_t soundTimer{}; //8-bit sound timer
-        uint8_t keypad[16]{}; //16 input keys
-        uint32_t video[64* 32]{}; //64 x 32 video output
-        uint16_t opcode; //for opcodes (instructions)
-
-        /*
-        Registers are labeled V0 - VF for the 16 registers available
-        As they are 8-bit, they can hold values from 0x00 - 0xFF
-        Register VF is used to hold flag values for instructions
-        */
-        /*
-        How the 4k bytes of memory are allocated
-        0x000 - 0x1FF: Not used in coded interpretors as this is where the interpretor was held in the actual CHIP-8
-        0x050 - 0x0A0: Storage area for fontset
-        0x200 - 0xFFF: Space for instructions
-        */
+        void tickTimers();
+        uint64_t displayHash();
+        uint64_t stateHash();
+        void addObserver(frameObserver observer);
+        void clearObservers();
+        void endFrame();
+        void snapshot(chip8State& out) const;
+        void restore(chip8State const& in);
+        size_t saveState(uint8_t* buffer, size_t size) const;
+        bool loadState(uint8_t const* buffer, size_t size);
+        bool saveStateFile(char const* fileName) const;
+        bool loadStateFile(char const* fileName);
 
     private:
+        static void shareTables();
+        static bool buildTables();
+        uint8_t randomByte();
+
+        vector<frameObserver> observers;
+
         //tables for functions
         void Table0();
         void Table8();
@@ -130,14 +208,21 @@ class chip8{
 
         void OP_Fx65();
 
+        //shared by every instance, a machine is its state and its observers
         typedef void (chip8::*chip8Func)();
-        chip8Func table[0xF + 1];
-        chip8Func table0[0xE +1];
-        chip8Func table8[0xE + 1];
-        chip8Func tableE[0xE + 1];
-        chip8Func tableF[0x65 + 1];
+        static chip8Func table[0xF + 1];
+        static chip8Func table0[0xF + 1];
+        static chip8Func table8[0xF + 1];
+        static chip8Func tableE[0xF + 1];
+        static chip8Func tableF[0xFF + 1];
 };
 
+chip8::chip8Func chip8::table[0xF + 1];
+chip8::chip8Func chip8::table0[0xF + 1];
+chip8::chip8Func chip8::table8[0xF + 1];
+chip8::chip8Func chip8::tableE[0xF + 1];
+chip8::chip8Func chip8::tableF[0xFF + 1];
+
 /*
 Fonts are stored in array and are loaded into memory
 Programs use fonts by using specific memory locations
@@ -168,9 +253,8 @@ uint8_t fonts[80]= {
 };
 
 //Constructor for chip8 class
-//the ': rando...' after the chip8() constructor is how you initialize a member, aka the rand generator
-//I seeded gen with system date
-chip8::chip8(): rando(chrono::system_clock::now().time_since_epoch().count()){
+//I seeded the RNG with system date
+chip8::chip8(){
     //init program counter
     pc= START_ADDRESS;
 
@@ -179,10 +263,30 @@ chip8::chip8(): rando(chrono::system_clock::now().time_since_epoch().count()){
         memory[START_ADDRESS_FONTS+ i]= fonts[i];
     }
 
-    //init RNG
-    randNum= uniform_int_distribution<>(0, 255);
+    //init RNG, xorshift gets stuck on 0
+    rngState= (uint32_t)chrono::system_clock::now().time_since_epoch().count()| 1u;
+
+    shareTables();
+}
+
+//a machine in the given state with no observers, no ROM load and no RNG seeding
+chip8::chip8(chip8State const& state): chip8State(state){
+    shareTables();
+}
+
+//fork for search: a copy of the plain state only, observers stay with the original
+chip8 chip8::clone() const{
+    return chip8(static_cast<chip8State const&>(*this));
+}
 
-    //function pointer table
+//the first machine fills the tables, thread safe as a function local static
+void chip8::shareTables(){
+    static bool built= buildTables();
+    (void)built;
+}
+
+//function pointer table
+bool chip8::buildTables(){
     table[0x0]= &chip8::Table0;
     table[0x1]= &chip8::OP_1nnn;
     table[0x2]= &chip8::OP_2nnn;
@@ -200,10 +304,12 @@ chip8::chip8(): rando(chrono::system_clock::now().time_since_epoch().count()){
     table[0xE]= &chip8::TableE;
     table[0xF]= &chip8::TableF;
 
-    for(size_t i= 0; i<= 0x65; i++){
+    for(size_t i= 0; i<= 0xF; i++){
         table0[i]= &chip8::OP_null;
         table8[i]= &chip8::OP_null;
         tableE[i]= &chip8::OP_null;
+    }
+    for(size_t i= 0; i<= 0xFF; i++){
         tableF[i]= &chip8::OP_null;
     }
 
@@ -220,8 +326,8 @@ chip8::chip8(): rando(chrono::system_clock::now().time_since_epoch().count()){
     table8[0x7]= &chip8::OP_8xy7;
     table8[0xE]= &chip8::OP_8xyE;
 
-    tableE[0x0]= &chip8::OP_Ex9E;
-    tableE[0xE]= &chip8::OP_ExA1;
+    tableE[0xE]= &chip8::OP_Ex9E;
+    tableE[0x1]= &chip8::OP_ExA1;
 
     tableF[0x07]= &chip8::OP_Fx07;
     tableF[0x0A]= &chip8::OP_Fx0A;
@@ -232,7 +338,7 @@ chip8::chip8(): rando(chrono::system_clock::now().time_since_epoch().count()){
     tableF[0x33]= &chip8::OP_Fx33;
     tableF[0x55]= &chip8::OP_Fx55;
     tableF[0x65]= &chip8::OP_Fx65;
-
+    return true;
 }
 
 //Loads a ROM for the emulator to run
@@ -250,7 +356,8 @@ void chip8::loadROM(char const* fileName){
         file.close();
 
         //load ROM into chip-8 memory (4k bytes) starting at location 0x200
-        for(long i=0; i<size; i++){ //may have to change to ++i
+        //anything that does not fit in the 3.5k above 0x200 is dropped
+        for(long i=0; i<size && START_ADDRESS+ (size_t)i< sizeof(memory); i++){ //may have to change to ++i
             memory[START_ADDRESS+ i]= buffer[i];
         }
 
@@ -261,12 +368,16 @@ void chip8::loadROM(char const* fileName){
 
 void chip8::FDEcycle(){
     //Fetch
-    opcode= (memory[pc]<< 8u) | memory[pc+ 1];
+    //addresses wrap at 4k like the 12-bit address space, a runaway ROM cannot read past memory
+    opcode= (memory[pc& 0xFFFu]<< 8u) | memory[(pc+ 1)& 0xFFFu];
     pc+= 2;
 
     //Decode & Execute
-    ((*this).*(table[(opcode & 0x000Fu)>> 12u]))();
+    ((*this).*(table[(opcode & 0xF000u)>> 12u]))();
+}
 
+//called at 60 Hz of emulated time by the scheduler
+void chip8::tickTimers(){
     //decrement timers if set
     if(delayTimer> 0){
         delayTimer--;
@@ -277,6 +388,157 @@ void chip8::FDEcycle(){
     }
 }
 
+//64-bit finaliser from splitmix64, spreads every input bit over the whole word
+uint64_t mix64(uint64_t x){
+    x^= x>> 30;
+    x*= 0xBF58476D1CE4E5B9ull;
+    x^= x>> 27;
+    x*= 0x94D049BB133111EBull;
+    x^= x>> 31;
+    return x;
+}
+
+//hash of the 64 x 32 display, meant to be called once per frame
+//rows are hashed on their own and XORed together so only rows touched by 00E0/Dxyn are hashed again
+uint64_t chip8::displayHash(){
+    while(dirtyRows){
+        int row= __builtin_ctz(dirtyRows);
+        dirtyRows&= dirtyRows- 1;
+
+        uint64_t hash= mix64(display[row]^ ((row+ 1)* 0x9E3779B97F4A7C15ull));
+        screenHash^= rowHash[row]^ hash;
+        rowHash[row]= hash;
+    }
+    return screenHash;
+}
+
+//hash of the display and everything else that decides what the machine does next
+uint64_t chip8::stateHash(){
+    uint64_t hash= displayHash();
+
+    //memory a word at a time
+    for(size_t i= 0; i< sizeof(memory); i+= 8){
+        uint64_t word;
+        memcpy(&word, &memory[i], 8);
+        hash= mix64(hash^ word);
+    }
+
+    uint64_t regs[2];
+    memcpy(regs, registers, sizeof(regs));
+    hash= mix64(hash^ regs[0]);
+    hash= mix64(hash^ regs[1]);
+
+    uint64_t calls[4];
+    memcpy(calls, stack, sizeof(calls));
+    for(uint64_t word: calls){
+        hash= mix64(hash^ word);
+    }
+
+    uint64_t misc= (uint64_t)index| ((uint64_t)pc<< 16) | ((uint64_t)sp<< 32) | ((uint64_t)delayTimer<< 40) | ((uint64_t)soundTimer<< 48)
+        | ((uint64_t)quirks<< 56);
+    hash= mix64(hash^ misc);
+
+    //the next Cxkk result and the keys Ex9E/ExA1/Fx0A will see
+    uint64_t inputs= (uint64_t)rngState| ((uint64_t)keypad<< 32);
+    return mix64(hash^ inputs);
+}
+
+//copies of the plain machine state, cheap enough to run every frame
+void chip8::snapshot(chip8State& out) const{
+    out= *this;
+}
+
+void chip8::restore(chip8State const& in){
+    static_cast<chip8State&>(*this)= in;
+}
+
+//writes SAVE_STATE_SIZE bytes, returns 0 when the buffer is too small
+size_t chip8::saveState(uint8_t* buffer, size_t size) const{
+    if(size< SAVE_STATE_SIZE){
+        return 0;
+    }
+    saveHeader header= {{'C', '8', 'S', 'S'}, SAVE_STATE_VERSION, sizeof(saveHeader), sizeof(chip8State), 0};
+    memcpy(buffer, &header, sizeof(header));
+    memcpy(buffer+ sizeof(header), static_cast<chip8State const*>(this), sizeof(chip8State));
+    return SAVE_STATE_SIZE;
+}
+
+//leaves the machine untouched and returns false if the buffer is not a state this build can load
+bool chip8::loadState(uint8_t const* buffer, size_t size){
+    saveHeader header;
+    if(size< SAVE_STATE_SIZE){
+        return false;
+    }
+    memcpy(&header, buffer, sizeof(header));
+    if(memcmp(header.magic, "C8SS", 4)!= 0 || header.version!= SAVE_STATE_VERSION
+        || header.headerSize!= sizeof(saveHeader) || header.stateSize!= sizeof(chip8State)){
+        return false;
+    }
+    //a quirk profile this build does not have would run the ROM differently
+    if(buffer[sizeof(header)+ offsetof(chip8State, quirks)]& ~QUIRKS_KNOWN){
+        return false;
+    }
+
+    memcpy(static_cast<chip8State*>(this), buffer+ sizeof(header), sizeof(chip8State));
+    //keep a corrupt state from indexing the stack out of range or stalling the RNG
+    sp&= 0xFu;
+    if(rngState== 0){
+        rngState= 1;
+    }
+    return true;
+}
+
+bool chip8::saveStateFile(char const* fileName) const{
+    uint8_t buffer[SAVE_STATE_SIZE];
+    saveState(buffer, sizeof(buffer));
+
+    ofstream file(fileName, std::ios::binary);
+    file.write((char const*)buffer, sizeof(buffer));
+    return file.good();
+}
+
+bool chip8::loadStateFile(char const* fileName){
+    uint8_t buffer[SAVE_STATE_SIZE];
+    ifstream file(fileName, std::ios::binary);
+    file.read((char*)buffer, sizeof(buffer));
+    return file.gcount()== (streamsize)sizeof(buffer) && loadState(buffer, sizeof(buffer));
+}
+
+//xorshift32, its state is part of chip8State so snapshots replay the same numbers
+uint8_t chip8::randomByte(){
+    rngState^= rngState<< 13;
+    rngState^= rngState>> 17;
+    rngState^= rngState<< 5;
+    return rngState>> 24;
+}
+
+//observers are called from endFrame, only for frames that drew to the display
+void chip8::addObserver(frameObserver observer){
+    observers.push_back(observer);
+}
+
+void chip8::clearObservers(){
+    observers.clear();
+}
+
+//the run loop calls this once per presented frame
+void chip8::endFrame(){
+    if(frameRows&& !observers.empty()){
+        frameChange change;
+        change.frame= frameCount;
+        change.rows= frameRows;
+        change.firstRow= __builtin_ctz(frameRows);
+        change.lastRow= 31- __builtin_clz(frameRows);
+        change.display= display;
+
+        for(frameObserver& observer: observers){
+            observer(change);
+        }
+    }
+    frameRows= 0;
+    frameCount++;
+}
+
 //function tables
 void chip8::Table0(){
     ((*this).*(table0[opcode & 0x000Fu]))();
@@ -291,7 +553,7 @@ void chip8::TableE(){
 }
 
 void chip8::TableF(){
-    ((*this).*(tableF[opcode & 0x000Fu]))();
+    ((*this).*(tableF[opcode & 0x00FFu]))();
 }
 
 //OPCODES
@@ -301,12 +563,14 @@ void chip8::OP_null(){}
 
 //clear screen
 void chip8::OP_00E0(){
-    memset(video, 0, sizeof(video));
+    memset(display, 0, sizeof(display));
+    dirtyRows= 0xFFFFFFFF;
+    frameRows= 0xFFFFFFFF;
 }
 
 //return from a subroutine
 void chip8::OP_00EE(){
-    sp--; //maybe --sp idk
+    sp= (sp- 1)& 0xFu; //the stack wraps instead of underflowing
     pc= stack[sp];
 }
 
@@ -320,7 +584,7 @@ void chip8::OP_1nnn(){
 void chip8::OP_2nnn(){
     uint16_t address= opcode & 0x0FFFu;
     stack[sp]= pc;
-    sp++; 
+    sp= (sp+ 1)& 0xFu;
     pc= address;
 }
 
@@ -468,13 +732,13 @@ void chip8::OP_9xy0(){
 
 //LD I, addr (set I= nnn)
 void chip8::OP_Annn(){
-    uint8_t address= opcode & 0x0FFFu;
+    uint16_t address= opcode & 0x0FFFu;
     index= address;
 }
 
 //JP V0, addr (jump to nnn + V0)
 void chip8::OP_Bnnn(){
-    uint8_t address= opcode & 0x0FFFu;
+    uint16_t address= opcode & 0x0FFFu;
     pc= registers[0]+ address;
 }
 
@@ -483,7 +747,7 @@ void chip8::OP_Cxkk(){
     uint8_t Vx= (opcode & 0x0F00u) >> 8u;
     uint8_t byte= opcode & 0x00FFu;
 
-    registers[Vx]= randNum(rando) & byte;
+    registers[Vx]= randomByte() & byte;
 }
 
 //DRW Vx, Vy, nibble (display n-byte at location (Vx, Vy) and set VF= collision)
@@ -498,18 +762,31 @@ void chip8::OP_Dxyn(){
 
     registers[0xF]= 0; //collision
 
+    //sprites are clipped at the right and bottom edges like the VIP, or wrap around under QUIRK_WRAP_SPRITES
+    bool wrap= quirks& QUIRK_WRAP_SPRITES;
     for(unsigned int row= 0; row< height; row++){ //maybe ++row
-        uint8_t spriteByte= memory[index+ row];
-        for(unsigned int col= 0; col< 8; col++){
-            uint8_t spritePixel= spriteByte & (0x80u>> col);
-            uint32_t* screenPixel= &video[(yPos+ row)* 64+ (xPos+ col)];
-
-            if(spritePixel){
-                if(*screenPixel== 0xFFFFFFFF){
-                    registers[0xF]= 1;
-                }
-                *screenPixel^= 0xFFFFFFFF;
+        unsigned int y= yPos+ row;
+        if(y>= VIDEO_HEIGHT){
+            if(!wrap){
+                break;
+            }
+            y-= VIDEO_HEIGHT;
+        }
+
+        //the byte lands in one row word with its first pixel at xPos, columns past 63 fall off the end
+        uint64_t spriteByte= memory[(index+ row)& 0xFFFu];
+        uint64_t sprite= (spriteByte<< 56)>> xPos;
+        if(wrap&& xPos> 56){
+            sprite|= spriteByte<< (120- xPos);
+        }
+
+        if(sprite){
+            if(display[y]& sprite){
+                registers[0xF]= 1;
             }
+            display[y]^= sprite;
+            dirtyRows|= 1u<< y;
+            frameRows|= 1u<< y;
         }
     }
 }
@@ -518,7 +795,7 @@ void chip8::OP_Dxyn(){
 void chip8::OP_Ex9E(){
     uint8_t Vx= (opcode & 0x0F00u)>> 8u;
     uint8_t key= registers[Vx];
-    if(keypad[key]){
+    if(keypad& (1u<< (key& 0xFu))){
         pc+= 2;
     }
 }
@@ -527,7 +804,7 @@ void chip8::OP_Ex9E(){
 void chip8::OP_ExA1(){
     uint8_t Vx= (opcode & 0x0F00u)>> 8u;
     uint8_t key= registers[Vx];
-    if(!keypad[key]){
+    if(!(keypad& (1u<< (key& 0xFu)))){
         pc+= 2;
     }
 }
@@ -542,46 +819,9 @@ void chip8::OP_Fx07(){
 void chip8::OP_Fx0A(){
     uint8_t Vx= (opcode & 0x0F00u)>> 8u;
 
-    // for(uint8_t i= 0; i< 16; i++){
-    //     if(keypad[i]){
-    //         registers[Vx]= i;
-    //     }else{
-    //         pc-= 2;
-    //     }
-    // }
-
-    if(keypad[0]){
-        registers[Vx]= 0;
-    }else if(keypad[1]){
-        registers[Vx]= 1;
-    }else if(keypad[2]){
-        registers[Vx]= 2;
-    }else if(keypad[3]){
-        registers[Vx]= 3;
-    }else if(keypad[4]){
-        registers[Vx]= 4;
-    }else if(keypad[5]){
-        registers[Vx]= 5;
-    }else if(keypad[6]){
-        registers[Vx]= 6;
-    }else if(keypad[7]){
-        registers[Vx]= 7;
-    }else if(keypad[8]){
-        registers[Vx]= 8;
-    }else if(keypad[9]){
-        registers[Vx]= 9;
-    }else if(keypad[10]){
-        registers[Vx]= 10;
-    }else if(keypad[11]){
-        registers[Vx]= 11;
-    }else if(keypad[12]){
-        registers[Vx]= 12;
-    }else if(keypad[13]){
-        registers[Vx]= 13;
-    }else if(keypad[14]){
-        registers[Vx]= 14;
-    }else if(keypad[15]){
-        registers[Vx]= 15;
+    //lowest pressed key wins, same as checking 0 to F in order
+    if(keypad){
+        registers[Vx]= __builtin_ctz(keypad);
     }else{
         pc-= 2;
     }
@@ -618,13 +858,13 @@ void chip8::OP_Fx33(){
     uint8_t Vx= (opcode & 0x0F00u)>> 8u;
     uint8_t val= registers[Vx];
 
-    memory[index+ 2]= val% 10;
+    memory[(index+ 2)& 0xFFFu]= val% 10;
     val/= 10;
 
-    memory[index+ 1]= val% 10;
+    memory[(index+ 1)& 0xFFFu]= val% 10;
     val/= 10;
 
-    memory[index]= val% 10;
+    memory[index& 0xFFFu]= val% 10;
 }
 
 //LD [I], Vx (store registers V0 to Vx in memory starting at location I)
@@ -632,7 +872,7 @@ void chip8::OP_Fx55(){
     uint8_t Vx= (opcode & 0x0F00u)>> 8u;
 
     for(uint8_t i=0; i<= Vx; i++){
-        memory[index+ i]= registers[i];
+        memory[(index+ i)& 0xFFFu]= registers[i];
     }
 }
 
@@ -641,6 +881,6 @@ void chip8::OP_Fx65(){
     uint8_t Vx= (opcode & 0x0F00u)>> 8u;
 
     for(uint8_t i=0; i<= Vx; i++){
-        registers[i]= memory[index+ i];
+        registers[i]= memory[(index+ i)& 0xFFFu];
     }
 }
\ No newline at end of file
@@ -0,0 +1,278 @@
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+/*
+CPU filter pipeline
+Takes the packed 64 x 32 display and writes a scaled ABGR8888 image straight into the texture
+Stages run in this order:
+        blend     - optional, combines the last N presented frames to hide XOR flicker
+        expand    - packed bits to a 64 x 32 colour image (plus glow halo if enabled)
+        scale     - nearest neighbour integer upscale
+        grid      - darken the last column of every scaled pixel
+        scanlines - darken the last line of every scaled pixel
+All buffers are sized in the constructor so a frame never allocates
+*/
+
+//how the frame history is combined
+//OR lights a pixel lit in any frame, DECAY fades a pixel by the age of its last lit frame,
+//PERSIST lights a pixel by the share of frames it was lit in
+enum blendMode{
+    BLEND_NONE,
+    BLEND_OR,
+    BLEND_DECAY,
+    BLEND_PERSIST
+};
+
+const int MAX_BLEND_FRAMES= 8;
+
+class filter{
+    public:
+        filter(int scale, bool scanlines, bool grid, bool glow);
+        void setBlend(blendMode mode, int frames);
+        void run(uint64_t const* rows, uint32_t* out, int pitch);
+
+        int scale;
+        bool scanlines;
+        bool grid;
+        bool glow;
+
+        uint32_t onColour= 0xFFFFFFFF;
+        uint32_t offColour= 0xFF000000;
+        uint32_t glowColour= 0xFF303030;
+
+        //cost of the pipeline in microseconds, measured every frame
+        float lastMicros{};
+        float maxMicros{};
+        float blendMicros{};
+
+    private:
+        void blendRow(int y, uint64_t lit, uint32_t* dst);
+
+        void expandRow(uint64_t bits, uint32_t colour, uint32_t* dst);
+        void fillRow(uint32_t colour, uint32_t* dst, int count);
+        void scaleRow(uint32_t const* src, uint32_t* dst);
+        void darkenRow(uint32_t* px, int count);
+
+        uint32_t source[64* 32]; //low res colour image
+        vector<uint32_t> line; //one scaled row
+        vector<uint32_t> darkLine; //the same row for the scanline
+
+        //fixed ring of packed frames, head is the newest
+        blendMode blend= BLEND_NONE;
+        int blendFrames= 1;
+        uint64_t history[MAX_BLEND_FRAMES][32]{};
+        int historyHead{};
+        int historyCount{};
+        uint32_t ageColour[MAX_BLEND_FRAMES]{};
+        uint32_t levelColour[MAX_BLEND_FRAMES+ 1]{};
+};
+
+filter::filter(int scale, bool scanlines, bool grid, bool glow): scale(scale< 1? 1: scale), scanlines(scanlines), grid(grid), glow(glow){
+    line.resize(64* this->scale);
+    darkLine.resize(64* this->scale);
+}
+
+//grey level with opaque alpha
+uint32_t greyColour(uint32_t level){
+    return 0xFF000000u | (level<< 16) | (level<< 8) | level;
+}
+
+void filter::setBlend(blendMode mode, int frames){
+    blend= mode;
+    //without blending only the current frame is kept, the glow halo is built from the same history
+    if(mode== BLEND_NONE){
+        frames= 1;
+    }
+    blendFrames= frames< 1? 1: (frames> MAX_BLEND_FRAMES? MAX_BLEND_FRAMES: frames);
+    historyHead= 0;
+    historyCount= 0;
+
+    for(int age= 0; age< MAX_BLEND_FRAMES; age++){
+        ageColour[age]= greyColour(255u>> age);
+    }
+    for(int level= 0; level<= MAX_BLEND_FRAMES; level++){
+        levelColour[level]= greyColour(255u* level/ blendFrames);
+    }
+}
+
+//SIMD kernels
+//every kernel has a scalar fallback for targets without SSE2
+
+//write colour to every pixel whose bit is set, leave the rest alone
+void filter::expandRow(uint64_t bits, uint32_t colour, uint32_t* dst){
+#if defined(__SSE2__)
+    const __m128i select= _mm_set_epi32(0x10, 0x20, 0x40, 0x80);
+    const __m128i col= _mm_set1_epi32((int)colour);
+
+    for(int byte= 0; byte< 8; byte++){
+        uint32_t b= (bits>> (56- byte* 8)) & 0xFFu;
+        if(!b){
+            continue;
+        }
+        __m128i high= _mm_set1_epi32((int)b);
+        __m128i low= _mm_set1_epi32((int)(b<< 4));
+
+        for(int half= 0; half< 2; half++){
+            __m128i v= half? low: high;
+            __m128i mask= _mm_cmpeq_epi32(_mm_and_si128(v, select), select);
+            __m128i* p= (__m128i*)(dst+ byte* 8+ half* 4);
+            __m128i old= _mm_loadu_si128(p);
+            _mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(mask, col), _mm_andnot_si128(mask, old)));
+        }
+    }
+#else
+    for(int x= 0; x< 64; x++){
+        if(bits& (1ull<< (63- x))){
+            dst[x]= colour;
+        }
+    }
+#endif
+}
+
+void filter::fillRow(uint32_t colour, uint32_t* dst, int count){
+    int x= 0;
+#if defined(__SSE2__)
+    const __m128i col= _mm_set1_epi32((int)colour);
+    for(; x+ 4<= count; x+= 4){
+        _mm_storeu_si128((__m128i*)(dst+ x), col);
+    }
+#endif
+    for(; x< count; x++){
+        dst[x]= colour;
+    }
+}
+
+//nearest neighbour, every source pixel becomes scale pixels
+void filter::scaleRow(uint32_t const* src, uint32_t* dst){
+    for(int x= 0; x< 64; x++){
+        fillRow(src[x], dst+ x* scale, scale);
+    }
+}
+
+//halve the RGB channels, alpha stays opaque
+void filter::darkenRow(uint32_t* px, int count){
+    int x= 0;
+#if defined(__SSE2__)
+    const __m128i keep= _mm_set1_epi32(0x007F7F7F);
+    const __m128i alpha= _mm_set1_epi32((int)0xFF000000);
+    for(; x+ 4<= count; x+= 4){
+        __m128i v= _mm_loadu_si128((__m128i*)(px+ x));
+        v= _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 1), keep), alpha);
+        _mm_storeu_si128((__m128i*)(px+ x), v);
+    }
+#endif
+    for(; x< count; x++){
+        px[x]= ((px[x]>> 1) & 0x007F7F7Fu) | 0xFF000000u;
+    }
+}
+
+//writes one row of the blended history, works on whole 64 pixel words so the cost does not depend on the scale
+void filter::blendRow(int y, uint64_t lit, uint32_t* dst){
+    switch(blend){
+        case BLEND_NONE:{
+            expandRow(history[historyHead][y], onColour, dst);
+        } break;
+
+        case BLEND_OR:{
+            expandRow(lit, onColour, dst);
+        } break;
+
+        case BLEND_DECAY:{
+            //oldest first so newer frames paint over with brighter colours
+            for(int age= historyCount- 1; age>= 0; age--){
+                int slot= (historyHead- age+ MAX_BLEND_FRAMES)% MAX_BLEND_FRAMES;
+                expandRow(history[slot][y], ageColour[age], dst);
+            }
+        } break;
+
+        case BLEND_PERSIST:{
+            //bit sliced counter, plane n holds bit n of how many frames each pixel was lit in
+            uint64_t planes[4]{};
+            for(int age= 0; age< historyCount; age++){
+                uint64_t carry= history[(historyHead- age+ MAX_BLEND_FRAMES)% MAX_BLEND_FRAMES][y];
+                for(int n= 0; n< 4 && carry; n++){
+                    uint64_t next= planes[n]& carry;
+                    planes[n]^= carry;
+                    carry= next;
+                }
+            }
+            for(int level= 1; level<= historyCount; level++){
+                uint64_t mask= ~0ull;
+                for(int n= 0; n< 4; n++){
+                    mask&= (level& (1<< n))? planes[n]: ~planes[n];
+                }
+                expandRow(mask, levelColour[level], dst);
+            }
+        } break;
+    }
+}
+
+//pitch is in bytes, like SDL_LockTexture gives back
+void filter::run(uint64_t const* rows, uint32_t* out, int pitch){
+    auto start= chrono::steady_clock::now();
+    int width= 64* scale;
+
+    //keep the last blendFrames frames
+    historyHead= (historyHead+ 1)% MAX_BLEND_FRAMES;
+    memcpy(history[historyHead], rows, sizeof(history[0]));
+    if(historyCount< blendFrames){
+        historyCount++;
+    }
+
+    //blend, expand and glow
+    for(int y= 0; y< 32; y++){
+        uint32_t* dst= &source[y* 64];
+        fillRow(offColour, dst, 64);
+
+        uint64_t lit[3]{}; //rows y-1, y and y+1 of every frame in the history
+        for(int age= 0; age< historyCount; age++){
+            uint64_t const* frame= history[(historyHead- age+ MAX_BLEND_FRAMES)% MAX_BLEND_FRAMES];
+            lit[0]|= y> 0? frame[y- 1]: 0;
+            lit[1]|= frame[y];
+            lit[2]|= y< 31? frame[y+ 1]: 0;
+        }
+
+        if(glow){
+            //halo is every unlit pixel next to a lit one
+            uint64_t halo= (lit[1]<< 1) | (lit[1]>> 1) | lit[0] | lit[2];
+            expandRow(halo& ~lit[1], glowColour, dst);
+        }
+        blendRow(y, lit[1], dst);
+    }
+    blendMicros= chrono::duration<float, micro>(chrono::steady_clock::now()- start).count();
+
+    //scale, grid and scanlines
+    for(int y= 0; y< 32; y++){
+        scaleRow(&source[y* 64], line.data());
+
+        if(grid&& scale> 1){
+            for(int x= scale- 1; x< width; x+= scale){
+                darkenRow(&line[x], 1);
+            }
+        }
+
+        bool dark= scanlines&& scale> 1;
+        if(dark){
+            memcpy(darkLine.data(), line.data(), width* sizeof(uint32_t));
+            darkenRow(darkLine.data(), width);
+        }
+
+        for(int sub= 0; sub< scale; sub++){
+            uint32_t* dst= (uint32_t*)((uint8_t*)out+ (y* scale+ sub)* pitch);
+            uint32_t const* src= (dark&& sub== scale- 1)? darkLine.data(): line.data();
+            memcpy(dst, src, width* sizeof(uint32_t));
+        }
+    }
+
+    lastMicros= chrono::duration<float, micro>(chrono::steady_clock::now()- start).count();
+    if(lastMicros> maxMicros){
+        maxMicros= lastMicros;
+    }
+}
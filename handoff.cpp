@@ -0,0 +1,47 @@
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+//one finished frame as the emulation thread hands it to the render thread
+struct presentedFrame{
+    uint64_t rows[32];
+    bool tone;
+};
+
+/*
+Lock-free triple buffer between one producer (emulation) and one consumer (render)
+The producer always owns a back slot and the consumer a front slot, the third sits in the middle
+publish swaps back and middle and marks it fresh, latest swaps front and middle if it is fresh
+Neither side ever waits, the consumer always gets the newest complete frame and frames never tear
+*/
+class tripleBuffer{
+    public:
+        presentedFrame& back(){ return slots[backIndex]; }
+        void publish();
+        presentedFrame const* latest();
+
+    private:
+        static const uint8_t FRESH= 0x4;
+        static const uint8_t INDEX= 0x3;
+
+        presentedFrame slots[3]{};
+        atomic<uint8_t> middle{1};
+        uint8_t backIndex= 0; //producer only
+        uint8_t frontIndex= 2; //consumer only
+};
+
+void tripleBuffer::publish(){
+    uint8_t old= middle.exchange(backIndex| FRESH, memory_order_acq_rel);
+    backIndex= old& INDEX;
+}
+
+//newest published frame, or nullptr when nothing new arrived since the last call
+presentedFrame const* tripleBuffer::latest(){
+    if(!(middle.load(memory_order_acquire) & FRESH)){
+        return nullptr;
+    }
+    uint8_t old= middle.exchange(frontIndex, memory_order_acq_rel);
+    frontIndex= old& INDEX;
+    return &slots[frontIndex];
+}
@@ -0,0 +1,331 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+const int LATENCY_WARMUP_FRAMES= 180; //lets the ROM get past its title screen into its input loop
+const int LATENCY_SAMPLES= 4; //press points per key
+const int LATENCY_SAMPLE_SPACING= 7; //frames between press points, so they land at different phases of the ROM's loop
+const int LATENCY_MAX_FRAMES= 120; //a key that changes nothing for 2 s counts as no response
+const int LATENCY_TIMED_PRESSES= 8; //responses replayed in real time per setting, each takes a few frames of wall clock
+const int LATENCY_MAX_LATE_FRAMES= 4; //a timed replay that has not shown the response this many frames late is dropped
+const uint32_t LATENCY_SEED= 0x2545F491; //fixed RNG seed, every run measures the same thing
+
+/*
+Headless input-to-photon latency harness
+Every ROM is warmed up on a virtual clock, then at several press points the machine is snapshot and
+run twice from the same state: once untouched (control) and once with one key held from the next input poll
+Both go through the run-ahead path main presents from, the first present that differs from the control is the response
+cycles - instructions from the press to the instruction that changed the display
+frames - presents from the press to the first one showing the change, 1 is the very next present
+us     - wall clock from the key going down to that present, measured with steady_clock by replaying the first
+         responses in real time through the pacer, the run-ahead and, for the threaded rows, the triple buffer handoff
+         the press lands at a different point of the frame each replay, presenting itself costs nothing here
+cycles and frames are deterministic and only move when the core or the settings change, us moves with the host
+*/
+
+struct latencyConfig{
+    bool vipTiming;
+    int runahead;
+};
+
+//how the frames are paced while timing, spin and jitter are the pacer settings
+struct latencyPacing{
+    int spinMicros;
+    int jitterMicros;
+    bool threaded;
+};
+
+struct latencySample{
+    bool responded;
+    uint64_t cycles;
+    int frames;
+};
+
+//everything a timed replay needs to repeat one press
+struct latencyPress{
+    chip8State base;
+    scheduler clock;
+    uint16_t keys;
+    int frames;
+    uint64_t target[32]; //the first present that showed the press
+};
+
+//what the present after the machine's current frame shows
+void latencyShown(chip8& machine, scheduler const& clock, int runahead, chip8State& scratch, uint64_t* rows){
+    if(runahead> 0){
+        clock.runAhead(machine, runahead, scratch, rows);
+    }else{
+        memcpy(rows, machine.display, sizeof(machine.display));
+    }
+}
+
+//control and pressed are scratch machines, both start from base, the response is left in press
+//the instruction search steps forks from pool
+latencySample measurePress(chip8& control, chip8& pressed, chip8State const& base, scheduler const& clock, uint16_t keys, int runahead,
+    latencyPress& press, clonePool& pool){
+    latencySample sample{};
+    scheduler controlClock= clock;
+    scheduler pressedClock= clock;
+    control.restore(base);
+    pressed.restore(base);
+    pressed.keypad= keys;
+
+    chip8State controlFrame;
+    chip8State pressedFrame;
+    chip8State scratch;
+    uint64_t controlRows[32];
+    uint64_t pressedRows[32];
+    bool changed= false;
+
+    for(int frame= 0; frame< LATENCY_MAX_FRAMES; frame++){
+        control.snapshot(controlFrame);
+        pressed.snapshot(pressedFrame);
+        uint64_t cyclesBefore= pressedClock.cycles;
+
+        controlClock.runFrame(control);
+        pressedClock.runFrame(pressed);
+
+        if(!changed&& memcmp(control.display, pressed.display, sizeof(control.display))!= 0){
+            //replay the frame an instruction at a time to find the one that made the difference
+            chip8* controlStep= pool.fork(controlFrame);
+            chip8* pressedStep= pool.fork(pressedFrame);
+            uint64_t frameCycles= pressedClock.cycles- cyclesBefore;
+            uint64_t step= 0;
+            while(step< frameCycles){
+                controlStep->FDEcycle();
+                pressedStep->FDEcycle();
+                step++;
+                if(memcmp(controlStep->display, pressedStep->display, sizeof(controlStep->display))!= 0){
+                    break;
+                }
+            }
+            pool.release(controlStep);
+            pool.release(pressedStep);
+            changed= true;
+            sample.cycles= cyclesBefore- clock.cycles+ step;
+        }
+
+        //with run-ahead a present can show the change before the frame that makes it has run
+        if(sample.frames== 0){
+            latencyShown(control, controlClock, runahead, scratch, controlRows);
+            latencyShown(pressed, pressedClock, runahead, scratch, pressedRows);
+            if(memcmp(controlRows, pressedRows, sizeof(controlRows))!= 0){
+                sample.frames= frame+ 1;
+                memcpy(press.target, pressedRows, sizeof(press.target));
+            }
+        }
+
+        if(changed&& sample.frames> 0){
+            sample.responded= true;
+            press.base= base;
+            press.clock= clock;
+            press.keys= keys;
+            press.frames= sample.frames;
+            return sample;
+        }
+    }
+    return sample;
+}
+
+/*
+Replays one press in real time through main's frame loop: sleep to the frame, poll the keys, emulate, present
+The key goes down phase of a frame before the next poll, the threaded loop presents half a frame out of step
+with the emulation since the two run on their own clocks
+Returns the microseconds from the key going down to the present showing press.target, or -1 if it never did
+*/
+double timePress(chip8& machine, latencyPress const& press, int runahead, latencyPacing const& pacing, double phase){
+    machine.restore(press.base);
+    scheduler clock= press.clock;
+    atomic<uint16_t> keymask{0};
+    chip8State scratch;
+    int limit= press.frames+ LATENCY_MAX_LATE_FRAMES;
+
+    auto period= chrono::nanoseconds(1000000000/ TIMER_HZ);
+    auto start= chrono::steady_clock::now()+ period;
+    auto pressAt= start- chrono::nanoseconds((int64_t)(phase* period.count()));
+    pacer pace(pacing.spinMicros, pacing.jitterMicros);
+    chrono::steady_clock::time_point down;
+
+    if(!pacing.threaded){
+        pace.waitUntil(pressAt);
+        keymask.store(press.keys);
+        down= chrono::steady_clock::now();
+
+        uint64_t rows[32];
+        auto deadline= start;
+        for(int frame= 0; frame< limit; frame++){
+            pace.waitUntil(deadline);
+            deadline+= period;
+            machine.keypad= keymask.load(memory_order_relaxed);
+            clock.runFrame(machine);
+            latencyShown(machine, clock, runahead, scratch, rows);
+            if(memcmp(rows, press.target, sizeof(rows))== 0){
+                return chrono::duration<double, micro>(chrono::steady_clock::now()- down).count();
+            }
+        }
+        return -1;
+    }
+
+    tripleBuffer handoff;
+    atomic<bool> stop{false};
+    thread emulation([&]{
+        pacer emulationPace(pacing.spinMicros, pacing.jitterMicros);
+        auto deadline= start;
+        while(!stop.load()){
+            emulationPace.waitUntil(deadline);
+            deadline+= period;
+            machine.keypad= keymask.load(memory_order_relaxed);
+            clock.runFrame(machine);
+            latencyShown(machine, clock, runahead, scratch, handoff.back().rows);
+            handoff.publish();
+        }
+    });
+
+    pace.waitUntil(pressAt);
+    keymask.store(press.keys);
+    down= chrono::steady_clock::now();
+
+    double micros= -1;
+    presentedFrame const* shown= nullptr;
+    auto refresh= start+ period/ 2;
+    for(int frame= 0; frame< limit; frame++){
+        pace.waitUntil(refresh);
+        refresh+= period;
+        presentedFrame const* fresh= handoff.latest();
+        if(fresh){
+            shown= fresh;
+        }
+        if(shown&& memcmp(shown->rows, press.target, sizeof(shown->rows))== 0){
+            micros= chrono::duration<double, micro>(chrono::steady_clock::now()- down).count();
+            break;
+        }
+    }
+    stop.store(true);
+    emulation.join();
+    return micros;
+}
+
+//report lines for one ROM and one setting: every key at every press point, timed under each pacing
+void measureRom(char const* rom, int ips, latencyConfig const& config, vector<latencyPacing> const& pacings){
+    chip8 control;
+    control.loadROM(rom);
+    control.rngState= LATENCY_SEED;
+    chip8 pressed= control.clone();
+    clonePool pool(2);
+
+    scheduler clock(ips, false);
+    clock.vipTiming= config.vipTiming;
+    for(int i= 0; i< LATENCY_WARMUP_FRAMES; i++){
+        clock.runFrame(control);
+    }
+
+    uint16_t responding= 0;
+    int responses= 0;
+    uint64_t cyclesTotal= 0, cyclesMax= 0;
+    int framesTotal= 0, framesMax= 0;
+    vector<latencyPress> timed;
+
+    chip8State base;
+    latencyPress press{{}, clock, 0, 0, {}};
+    for(int point= 0; point< LATENCY_SAMPLES; point++){
+        control.snapshot(base);
+        for(int key= 0; key< 16; key++){
+            latencySample sample= measurePress(control, pressed, base, clock, 1u<< key, config.runahead, press, pool);
+            if(!sample.responded){
+                continue;
+            }
+            responding|= 1u<< key;
+            responses++;
+            cyclesTotal+= sample.cycles;
+            cyclesMax= sample.cycles> cyclesMax? sample.cycles: cyclesMax;
+            framesTotal+= sample.frames;
+            framesMax= sample.frames> framesMax? sample.frames: framesMax;
+            if(timed.size()< (size_t)LATENCY_TIMED_PRESSES){
+                timed.push_back(press);
+            }
+        }
+
+        //next press point, the untouched machine keeps running
+        control.restore(base);
+        for(int i= 0; i< LATENCY_SAMPLE_SPACING; i++){
+            clock.runFrame(control);
+        }
+    }
+
+    string timing= config.vipTiming? "vip": "ips"+ to_string(ips);
+    for(latencyPacing const& pacing: pacings){
+        string paced= "spin"+ to_string(pacing.spinMicros)+ (pacing.threaded? "+thread": "");
+        printf("%-24s %-8s %5d %-14s %5d/16", rom, timing.c_str(), config.runahead, paced.c_str(), __builtin_popcount(responding));
+        if(responses== 0){
+            printf("  no key changed the display\n");
+            continue;
+        }
+
+        int count= 0;
+        double microsTotal= 0, microsMax= 0;
+        for(size_t i= 0; i< timed.size(); i++){
+            double micros= timePress(pressed, timed[i], config.runahead, pacing, (i+ 0.5)/ timed.size());
+            if(micros< 0){
+                continue;
+            }
+            count++;
+            microsTotal+= micros;
+            microsMax= micros> microsMax? micros: microsMax;
+        }
+        printf(" %9.1f %7llu %8.2f %5d", (double)cyclesTotal/ responses, (unsigned long long)cyclesMax,
+            (double)framesTotal/ responses, framesMax);
+        if(count> 0){
+            printf(" %9.1f %9.1f\n", microsTotal/ count, microsMax);
+        }else{
+            printf(" %9s %9s\n", "-", "-");
+        }
+    }
+}
+
+//positional ROM plus the comma separated --latency list, each with and without VIP timing and run-ahead
+int runLatency(options const& opts){
+    vector<string> roms;
+    roms.push_back(opts.romFilename);
+    size_t start= 0;
+    while(start< opts.latencyRoms.size()){
+        size_t end= opts.latencyRoms.find(',', start);
+        if(end== string::npos){
+            end= opts.latencyRoms.size();
+        }
+        if(end> start){
+            roms.push_back(opts.latencyRoms.substr(start, end- start));
+        }
+        start= end+ 1;
+    }
+
+    int runahead= opts.runahead> 0? opts.runahead: 2;
+    latencyConfig configs[]= {
+        {false, 0},
+        {false, runahead},
+        {true, 0},
+        {true, runahead},
+    };
+
+    //the main loop as configured, the pacer sleeping as close to the deadline as it can, and the threaded loop
+    vector<latencyPacing> pacings= {
+        {opts.spinMicros, opts.jitterMicros, false},
+        {0, opts.jitterMicros, false},
+        {opts.spinMicros, opts.jitterMicros, true},
+    };
+
+    printf("%-24s %-8s %5s %-14s %8s %9s %7s %8s %5s %9s %9s\n", "rom", "timing", "ahead", "pacing", "keys",
+        "cycles", "max", "frames", "max", "us", "max");
+    for(string const& rom: roms){
+        for(latencyConfig const& config: configs){
+            measureRom(rom.c_str(), instructionsPerSecond(opts), config, pacings);
+        }
+    }
+    return 0;
+}
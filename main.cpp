@@ -1,41 +1,501 @@
 #include "chip-8.cpp"
+#include "pool.cpp"
+#include "filter.cpp"
+#include "backend.cpp"
+#include "beeper.cpp"
+#include "metrics.cpp"
 #include "platform.cpp"
+#include "recorder.cpp"
+#include "capture.cpp"
+#include "vip.cpp"
+#include "scheduler.cpp"
+#include "pacer.cpp"
+#include "rewind.cpp"
+#include "movie.cpp"
+#include "options.cpp"
+#include "mosaic.cpp"
+#include "handoff.cpp"
+#include "latency.cpp"
+#include "netplay.cpp"
+#include "selftest.cpp"
 #include <chrono>
 #include <cstdlib>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <thread>
 
 using namespace std;
 
 int main(int argc, char** argv){
+    options opts;
 
-    if(argc!= 4){
-        cerr<<"Usage: "<<argv[0]<<" <Scale> <Delay> <ROM>\n";
+    if(!parseOptions(argc, argv, opts)){
+        cerr<<"Usage: "<<argv[0]<<" <Scale> <Delay> <ROM> [options]\n"
+            <<"  --filter=scale|crt|scanlines,grid,glow\n"
+            <<"  --blend=none|or|decay|persist[:frames]\n"
+            <<"  --profile=default|kiosk\n"
+            <<"  --backend=sdl|null|term|file:<path>\n"
+            <<"  --frames=<count>\n"
+            <<"  --record=<path|->  --record-format=y4m|rgba  --record-scale=<n>\n"
+            <<"  --screenshot=<png>  --clip=<gif>\n"
+            <<"  --hash  --hash-log=<path|->\n"
+            <<"  --mosaic=<columns>x<rows>\n"
+            <<"  --ips=<instructions per second>  --timing=ips|vip  --virtual  --seed=<n>\n"
+            <<"  --wrap-sprites\n"
+            <<"  --spin=<us>  --jitter=<us>\n"
+            <<"  --turbo[=<multiplier>]\n"
+            <<"  --audio-buffer=<samples>  --no-audio  --audio-clock\n"
+            <<"  --keymap=<file>\n"
+            <<"  --threaded\n"
+            <<"  --runahead=<frames>\n"
+            <<"  --metrics=<json|->\n"
+            <<"  --latency[=<rom,rom,...>]\n"
+            <<"  --load-state=<file>  --save-state=<file>\n"
+            <<"  --rewind=<MB>\n"
+            <<"  --movie=<file>  --movie-keyframes=<seconds>  --replay=<file>  --seek=<seconds>\n"
+            <<"  --netplay=<local port>:<peer host>:<peer port>  --netplay-test[=<delay ms>[,<loss %>]]\n"
+            <<"  --self-test[=<movie>]\n";
         exit(EXIT_FAILURE);
     }
 
-    int videoScale= stoi(argv[1]);
-    int cycleDelay= stoi(argv[2]);
-    char const* romFilename= argv[3];
+    if(opts.latency){
+        return runLatency(opts);
+    }
+    if(opts.netplayTest){
+        return runNetplayTest(opts);
+    }
+    if(opts.selfTest){
+        return runSelfTest(opts);
+    }
+
+    if(opts.mosaicColumns> 0 && opts.mosaicRows> 0){
+        return runMosaic(opts);
+    }
+
+    int videoScale= opts.videoScale;
+    char const* romFilename= opts.romFilename;
+
+    //with the CPU filter the texture is already window sized, otherwise SDL stretches the 64 x 32 texture
+    int textureScale= opts.filter? videoScale: 1;
+    filter screenFilter(textureScale, opts.scanlines, opts.grid, opts.glow);
+    screenFilter.setBlend(opts.blend, opts.blendFrames);
+
+    //only the SDL backend touches SDL video
+    unique_ptr<backend> host;
+    platform* window= nullptr; //the SDL window when that is the backend
+    if(opts.backendName== "null"){
+        host.reset(new nullBackend());
+    }else if(opts.backendName== "term"){
+        host.reset(new termBackend());
+    }else if(opts.backendName== "file"){
+        host.reset(new fileBackend(opts.backendPath.c_str()));
+    }else{
+        window= new platform("Chip-8", 64* videoScale, 32* videoScale, 64* textureScale, 32* textureScale);
+        window->screenFilter= &screenFilter;
+        if(!opts.keymapPath.empty()){
+            window->loadKeymap(opts.keymapPath.c_str());
+        }
+        host.reset(window);
+    }
+
+    //frame timing is always measured, --metrics writes it on exit and SIGUSR1 at any time
+    const auto refresh= chrono::nanoseconds(1000000000/ TIMER_HZ);
+    metrics stats(refresh);
+    bool selfTimed= window!= nullptr;
+    if(selfTimed){
+        window->stats= &stats;
+    }
+    installMetricsSignal();
+
+    //declared after host so it closes before SDL_Quit
+    unique_ptr<beeper> buzzer;
+    if(opts.audio&& window){
+        buzzer.reset(new beeper(opts.audioBuffer, 440.0f, opts.audioClock));
+        if(!opts.audioClock){
+            window->buzzer= buzzer.get();
+        }
+    }
+
+    unique_ptr<recorder> rec;
+    if(!opts.recordPath.empty()){
+        rec.reset(new recorder(opts.recordPath.c_str(), opts.recordY4m, opts.recordScale));
+    }
+
+    //F12 saves a screenshot, F11 starts and stops a clip
+    capture grab(videoScale);
+    int screenshots= 0;
+    int clips= 0;
+    if(!opts.clipPath.empty()){
+        grab.beginClip(opts.clipPath);
+    }
+
+    //netplay peers have to start from the same machine and a virtual clock run has to repeat,
+    //so both seed the RNG from the ROM unless --seed picks the seed
+    bool netplay= opts.netplayPort> 0;
+    if(netplay&& (!opts.moviePath.empty() || !opts.replayPath.empty())){
+        cerr<<"Movies cannot record or replay a netplay session\n";
+        exit(EXIT_FAILURE);
+    }
 
-    platform platform("Chip-8", 64* videoScale, 32* videoScale, 64, 32);
     chip8 chip8;
     chip8.loadROM(romFilename);
+    setupMachine(chip8, opts);
+    if(!opts.loadStatePath.empty()&& !chip8.loadStateFile(opts.loadStatePath.c_str())){
+        cerr<<"Could not load state "<<opts.loadStatePath<<"\n";
+        exit(EXIT_FAILURE);
+    }
+
+    //every frame goes into the rewind history, holding Backspace steps back through it
+    //a movie has to see every frame run forwards, so rewind and F9 are off while one records or plays,
+    //netplay peers only stay in step on the inputs they exchange, so the same goes for them and turbo
+    //only the SDL backend has a Backspace to hold, headless runs do not pay for the history
+    bool lockstep= !opts.moviePath.empty() || !opts.replayPath.empty() || netplay;
+    unique_ptr<rewindBuffer> history;
+    if(opts.rewindBytes> 0&& !lockstep&& window){
+        history.reset(new rewindBuffer(opts.rewindBytes));
+    }
+    bool rewinding= false;
+
+    //F5 saves to a slot in memory and F9 loads it back
+    uint8_t quickSave[SAVE_STATE_SIZE];
+    bool quickSaved= false;
+
+    //one line per frame that changed the display: frame number and display hash
+    FILE* hashLog= nullptr;
+    if(!opts.hashLog.empty()){
+        hashLog= opts.hashLog== "-"? stdout: fopen(opts.hashLog.c_str(), "w");
+    }
+    if(hashLog){
+        chip8.addObserver([&](frameChange const& change){
+            fprintf(hashLog, "%llu %016llx\n", (unsigned long long)change.frame, (unsigned long long)chip8.displayHash());
+        });
+    }
+
+    //timers run at 60 Hz of emulated time, <Delay> only sets the instruction rate
+    scheduler clock(instructionsPerSecond(opts), !opts.virtualClock);
+    clock.vipTiming= opts.vipTiming;
+    pacer pace(opts.spinMicros, opts.jitterMicros);
+    atomic<bool> quit{false};
+    bool audioClock= buzzer&& buzzer->isOpen()&& opts.audioClock&& !opts.virtualClock;
+
+    //--movie records the keypad and keyframes, --replay plays one back in place of the keyboard
+    unique_ptr<movieWriter> movie;
+    unique_ptr<moviePlayer> replay;
+    if(!opts.replayPath.empty()){
+        replay.reset(new moviePlayer());
+        if(!replay->load(opts.replayPath.c_str())){
+            cerr<<"Could not read movie "<<opts.replayPath<<"\n";
+            exit(EXIT_FAILURE);
+        }
+        if(replay->header.romHash!= hashFile(romFilename)){
+            cerr<<"Movie was recorded with a different ROM\n";
+            exit(EXIT_FAILURE);
+        }
+        clock.ips= replay->header.ips;
+        clock.vipTiming= replay->header.vipTiming;
+        if(!replay->seek(chip8, clock, (uint64_t)(opts.seekSeconds* TIMER_HZ))){
+            cerr<<"Movie keyframe does not load\n";
+            exit(EXIT_FAILURE);
+        }
+    }else if(!opts.moviePath.empty()){
+        movieHeader header= {{'C', '8', 'M', 'V'}, MOVIE_VERSION, chip8.quirks, (uint8_t)clock.vipTiming,
+            hashFile(romFilename), chip8.rngState, (uint32_t)clock.ips, (uint32_t)(opts.movieKeyframeSeconds* TIMER_HZ), 0};
+        movie.reset(new movieWriter(opts.moviePath.c_str(), header));
+    }
+
+    //--netplay runs every frame through the rollback session, the peer's keys are ORed with the local ones
+    unique_ptr<udpSocket> link;
+    unique_ptr<netplaySession> net;
+    if(netplay){
+        link.reset(new udpSocket((uint16_t)opts.netplayPort));
+        if(!link->isOpen() || !link->connect(opts.netplayHost.c_str(), (uint16_t)opts.netplayPeerPort)){
+            cerr<<"Could not start netplay with "<<opts.netplayHost<<":"<<opts.netplayPeerPort<<"\n";
+            exit(EXIT_FAILURE);
+        }
+        net.reset(new netplaySession(*link, netplaySessionId(chip8, clock)));
+    }
+
+    //turbo runs turboFactor frames per displayed frame, or as many as fit in one when it is 0
+    bool turbo= opts.turbo&& !netplay;
+    bool netStalled= false;
+    auto nextPresent= chrono::steady_clock::now()+ refresh;
+
+    //hotkeys are handled on the emulation side, they touch the machine and the scheduler
+    auto handleHotkeys= [&](uint32_t keys){
+        if(keys& HOTKEY_SCREENSHOT){
+            grab.screenshot(chip8.display, "screenshot-"+ to_string(screenshots++)+ ".png");
+        }
+        if(keys& HOTKEY_CLIP){
+            if(grab.recording()){
+                grab.endClip();
+            }else{
+                grab.beginClip("clip-"+ to_string(clips++)+ ".gif");
+            }
+        }
+        if(keys& HOTKEY_SAVE_STATE){
+            quickSaved= chip8.saveState(quickSave, sizeof(quickSave))> 0;
+        }
+        if(keys& HOTKEY_LOAD_STATE&& quickSaved&& !lockstep){
+            chip8.loadState(quickSave, sizeof(quickSave));
+        }
+        if(keys& HOTKEY_TURBO&& !netplay){
+            turbo= !turbo;
+            if(turbo){
+                nextPresent= chrono::steady_clock::now()+ refresh;
+            }else{
+                clock.resync();
+            }
+        }
+    };
+
+    //runs the frames that are due, returns how many ran
+    auto emulate= [&]()-> uint64_t{
+        //the audio device clock sets the pace, the wall clock only spreads the frames out
+        if(audioClock&& !turbo){
+            clock.setRate(buzzer->rateAdjust());
+        }
+
+        uint64_t due= turbo? (uint64_t)opts.turboFactor: clock.framesDue();
+        uint64_t ran= 0;
+        uint16_t localKeys= chip8.keypad;
+        rewinding= history&& host->rewindHeld.load(memory_order_relaxed);
+        while(!quit.load(memory_order_relaxed)){
+            if(turbo&& due== 0){
+                //uncapped, stop when the display wants a frame
+                if(chrono::steady_clock::now()>= nextPresent){
+                    break;
+                }
+            }else if(ran>= due){
+                break;
+            }
+
+            //seeking to the end or past it leaves nothing to replay
+            if(replay&& replay->finished(clock)){
+                quit.store(true);
+                break;
+            }
+
+            if(rewinding){
+                //backwards at the same pace, the clock keeps counting and the oldest frame stays put
+                history->stepBack(chip8);
+                clock.advance(0);
+            }else{
+                if(movie){
+                    movie->beginFrame(chip8, clock);
+                }else if(replay){
+                    replay->beginFrame(chip8, clock);
+                }
+                bool silent= chip8.soundTimer== 0;
+                if(net){
+                    //waiting for the peer, the frame stays due and the clock moves with the wait instead of catching up
+                    netStalled= !net->advance(chip8, clock, localKeys, chrono::steady_clock::now());
+                    if(netStalled){
+                        clock.resync();
+                        break;
+                    }
+                }else{
+                    clock.runFrame(chip8);
+                }
+                //buzzer latency runs from here, not from the present that turns the tone on
+                if(buzzer&& !audioClock&& silent&& chip8.soundTimer> 0){
+                    buzzer->markTone();
+                }
+                if(rec){
+                    rec->push(chip8.display);
+                }
+                grab.addFrame(chip8.display);
+                chip8.endFrame();
+                if(history){
+                    history->push(chip8);
+                }
+            }
+            if(audioClock&& !turbo){
+                buzzer->queue(chip8.soundTimer> 0, FRAME_SAMPLES);
+            }
+            ran++;
+        }
+        return ran;
+    };
+
+    //sleep until the next frame instead of polling
+    auto waitForNextFrame= [&](){
+        if(turbo){
+            auto now= chrono::steady_clock::now();
+            if(nextPresent> now){
+                pace.waitUntil(nextPresent);
+            }
+            nextPresent= nextPresent+ refresh> now? nextPresent+ refresh: now+ refresh;
+        }else if(netStalled){
+            pace.waitUntil(chrono::steady_clock::now()+ chrono::microseconds(NETPLAY_STALL_POLL_MICROS));
+        }else if(clock.wallClock){
+            pace.waitUntil(clock.frameTime(clock.frame));
+        }
+    };
+
+    //run-ahead: run the next frames on the current input, show that future, then roll back
+    //the extra frames are not recorded, drawn, heard or seen by observers
+    chip8State rollback;
+    uint64_t future[32];
+    auto frameToShow= [&]()-> uint64_t const*{
+        if(opts.runahead<= 0 || rewinding){
+            return chip8.display;
+        }
+        clock.runAhead(chip8, opts.runahead, rollback, future);
+        return future;
+    };
+
+    //the SDL backend times its own phases, the others are timed as a whole
+    //--frames counts presents, turbo and catching up run several emulated frames per present
+    uint64_t presented= 0;
+    auto show= [&](uint64_t const* rows, bool tone){
+        if(selfTimed){
+            host->present(rows);
+        }else{
+            phaseTimer timer(&stats, PHASE_PRESENT);
+            host->present(rows);
+        }
+        host->audio(tone);
+        stats.framePresented();
+        presented++;
+        if(opts.maxFrames> 0 && presented>= (uint64_t)opts.maxFrames){
+            quit.store(true);
+        }
+
+        if(metricsDumpRequested){
+            metricsDumpRequested= 0;
+            stats.dump(opts.metricsPath.c_str());
+        }
+    };
+
+    auto pollInput= [&]()-> bool{
+        phaseTimer timer(&stats, PHASE_INPUT);
+        return host->input();
+    };
+
+    if(opts.threaded){
+        //emulation publishes finished frames, this thread polls input and presents the newest one
+        tripleBuffer handoff;
+        atomic<uint32_t> pendingHotkeys{};
 
-    int videoPitch= sizeof(chip8.video[0])* 64;
-    auto lastCycleTime= chrono::high_resolution_clock::now();
-    bool quit= false;
+        thread emulation([&]{
+            while(!quit.load()){
+                chip8.keypad= host->keymask.load(memory_order_relaxed);
+                handleHotkeys(pendingHotkeys.exchange(0));
 
-    while(!quit){
-        quit= platform.input(chip8.keypad);
-        auto currentTime= chrono::high_resolution_clock::now();
-        float dt= chrono::duration<float, chrono::milliseconds::period>(currentTime- lastCycleTime).count();
+                uint64_t ran;
+                {
+                    phaseTimer timer(&stats, PHASE_EMULATE);
+                    ran= emulate();
+                }
+                if(ran> 0){
+                    presentedFrame& frame= handoff.back();
+                    memcpy(frame.rows, frameToShow(), sizeof(frame.rows));
+                    frame.tone= chip8.soundTimer> 0;
+                    handoff.publish();
+                }
+                if(!quit.load()){
+                    waitForNextFrame();
+                }
+            }
+        });
 
-        if(dt> cycleDelay){
-            lastCycleTime= currentTime;
-            chip8.FDEcycle();
-            platform.update(chip8.video, videoPitch);
+        pacer renderPace(opts.spinMicros, opts.jitterMicros);
+        auto nextRefresh= chrono::steady_clock::now()+ refresh;
+        presentedFrame const* shown= nullptr;
+        while(!quit.load()){
+            if(pollInput()){
+                quit.store(true);
+            }
+            pendingHotkeys.fetch_or(host->hotkeys);
+            host->hotkeys= 0;
+
+            //present every refresh, repeating the last frame when the emulation has not finished a new one
+            presentedFrame const* fresh= handoff.latest();
+            if(fresh){
+                shown= fresh;
+            }
+            if(shown){
+                show(shown->rows, shown->tone);
+            }
+
+            renderPace.waitUntil(nextRefresh);
+            auto now= chrono::steady_clock::now();
+            nextRefresh= nextRefresh+ refresh> now? nextRefresh+ refresh: now+ refresh;
+        }
+        emulation.join();
+    }else{
+        while(!quit.load()){
+            //input is polled once per frame, the emulation only sees the mask
+            if(pollInput()){
+                quit.store(true);
+            }
+            chip8.keypad= host->keymask.load(memory_order_relaxed);
+            handleHotkeys(host->hotkeys);
+            host->hotkeys= 0;
+
+            //only the newest frame is shown when catching up or in turbo
+            uint64_t ran;
+            {
+                phaseTimer timer(&stats, PHASE_EMULATE);
+                ran= emulate();
+            }
+            if(ran> 0){
+                show(frameToShow(), chip8.soundTimer> 0);
+            }
+            if(!quit.load()){
+                waitForNextFrame();
+            }
         }
     }
+
+    if(!opts.screenshotPath.empty()){
+        grab.screenshot(chip8.display, opts.screenshotPath);
+    }
+    if(movie){
+        movie->finish(chip8, clock);
+        cerr<<"Movie: "<<clock.frame<<" frames, "<<movie->transitions<<" keypad transitions, "<<movie->keyframes<<" keyframes\n";
+    }
+    if(replay&& replay->finished(clock)){
+        bool exact= replay->verify(chip8);
+        cerr<<"Replay "<<(exact? "matches": "diverged from")<<" the recording\n";
+        if(!exact){
+            return EXIT_FAILURE;
+        }
+    }
+    if(!opts.saveStatePath.empty()&& !chip8.saveStateFile(opts.saveStatePath.c_str())){
+        cerr<<"Could not save state "<<opts.saveStatePath<<"\n";
+    }
+
+    if(hashLog&& hashLog!= stdout){
+        fclose(hashLog);
+    }
+    if(opts.hash){
+        printf("display %016llx\nstate %016llx\n", (unsigned long long)chip8.displayHash(), (unsigned long long)chip8.stateHash());
+    }
+
+    //reports go to stderr so stdout stays clean for --record=-
+    if(rec){
+        rec->finish();
+        cerr<<"Recorded "<<rec->written<<" frames, dropped "<<rec->dropped<<"\n";
+    }
+    if(buzzer){
+        buzzer->report();
+    }
+    if(history){
+        history->report();
+    }
+    if(net){
+        net->report(stderr);
+    }
+    if(pace.waits> 0){
+        cerr<<"Pacing: spin "<<pace.currentSpinMicros<<" us, last wake "<<pace.lastLateMicros<<" us late, max "<<pace.maxLateMicros<<" us\n";
+    }
+    if(!opts.metricsPath.empty()){
+        stats.dump(opts.metricsPath.c_str());
+    }
+    if(opts.filter){
+        cerr<<"Filter cost: last "<<screenFilter.lastMicros<<" us (blend "<<screenFilter.blendMicros<<" us), max "<<screenFilter.maxMicros<<" us\n";
+    }
     return 0;
-}
\ No newline at end of file
+}
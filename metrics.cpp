@@ -0,0 +1,232 @@
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+
+using namespace std;
+
+//log-linear buckets: values below 128 ns are exact, above that every power of two is split in 64
+const int HISTOGRAM_SUB_BITS= 7;
+const int HISTOGRAM_SUB_BUCKETS= 1<< HISTOGRAM_SUB_BITS;
+const int HISTOGRAM_MAX_BITS= 40; //about 18 minutes in nanoseconds, larger values are clamped
+const int HISTOGRAM_BUCKETS= (HISTOGRAM_MAX_BITS- HISTOGRAM_SUB_BITS+ 1)* HISTOGRAM_SUB_BUCKETS/ 2+ HISTOGRAM_SUB_BUCKETS/ 2;
+
+//main loop phases that are timed every frame
+enum phase{
+    PHASE_INPUT,
+    PHASE_EMULATE,
+    PHASE_CONVERT, //packed frame to texture pixels, includes the CPU filter
+    PHASE_UPLOAD, //unlock and copy the texture
+    PHASE_PRESENT,
+    PHASE_COUNT
+};
+
+const char* const PHASE_NAMES[PHASE_COUNT]= {"input", "emulate", "convert", "upload", "present"};
+
+/*
+HDR-style histogram of nanosecond durations
+Recording is a bit scan and an increment, buckets are at most 1.6% of their value wide at any magnitude
+One writer per histogram, every value is a relaxed atomic so a dump from another thread (SIGUSR1 while the
+emulation thread records) reads whole values, the dump works from its own copy of the buckets and may see
+the newest frame half counted
+*/
+class histogram{
+    public:
+        void record(uint64_t nanos);
+        void writeJson(FILE* out) const;
+
+        atomic<uint64_t> count{};
+        atomic<uint64_t> total{};
+        atomic<uint64_t> min{UINT64_MAX};
+        atomic<uint64_t> max{};
+
+    private:
+        static int bucketOf(uint64_t value);
+        static uint64_t lowestIn(int bucket);
+        static uint64_t highestIn(int bucket);
+        static uint64_t percentile(uint64_t const* counts, uint64_t count, double q, uint64_t low, uint64_t high);
+
+        atomic<uint64_t> buckets[HISTOGRAM_BUCKETS]{};
+};
+
+//only the one writer stores, so a relaxed load and store is a whole increment and costs no more than a plain one
+void bump(atomic<uint64_t>& value, uint64_t by){
+    value.store(value.load(memory_order_relaxed)+ by, memory_order_relaxed);
+}
+
+int histogram::bucketOf(uint64_t value){
+    if(value< (uint64_t)HISTOGRAM_SUB_BUCKETS){
+        return (int)value;
+    }
+    int shift= 63- __builtin_clzll(value)- HISTOGRAM_SUB_BITS+ 1;
+    return shift* HISTOGRAM_SUB_BUCKETS/ 2+ (int)(value>> shift);
+}
+
+uint64_t histogram::lowestIn(int bucket){
+    if(bucket< HISTOGRAM_SUB_BUCKETS){
+        return bucket;
+    }
+    int shift= bucket/ (HISTOGRAM_SUB_BUCKETS/ 2)- 1;
+    return (uint64_t)(bucket- shift* HISTOGRAM_SUB_BUCKETS/ 2)<< shift;
+}
+
+//a bucket holds everything up to the next one's lower edge
+uint64_t histogram::highestIn(int bucket){
+    return lowestIn(bucket+ 1)- 1;
+}
+
+void histogram::record(uint64_t nanos){
+    if(nanos>= (1ull<< HISTOGRAM_MAX_BITS)){
+        nanos= (1ull<< HISTOGRAM_MAX_BITS)- 1;
+    }
+    bump(buckets[bucketOf(nanos)], 1);
+    bump(count, 1);
+    bump(total, nanos);
+    if(nanos< min.load(memory_order_relaxed)){
+        min.store(nanos, memory_order_relaxed);
+    }
+    if(nanos> max.load(memory_order_relaxed)){
+        max.store(nanos, memory_order_relaxed);
+    }
+}
+
+//highest value of the bucket holding the q quantile of count values, q in 0..1,
+//kept within the recorded low and high so a wide bucket cannot put p50 under min or p999 over max
+uint64_t histogram::percentile(uint64_t const* counts, uint64_t count, double q, uint64_t low, uint64_t high){
+    uint64_t rank= (uint64_t)(q* (count- 1));
+    uint64_t seen= 0;
+    int i= 0;
+    while(i< HISTOGRAM_BUCKETS- 1&& seen+ counts[i]<= rank){
+        seen+= counts[i];
+        i++;
+    }
+    uint64_t value= highestIn(i);
+    return value> high? high: value< low? low: value;
+}
+
+//summary and the non-empty buckets, all in microseconds, the count and percentiles come from one copy of the buckets
+void histogram::writeJson(FILE* out) const{
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t seen= 0;
+    for(int i= 0; i< HISTOGRAM_BUCKETS; i++){
+        counts[i]= buckets[i].load(memory_order_relaxed);
+        seen+= counts[i];
+    }
+
+    fprintf(out, "{\"count\":%llu", (unsigned long long)seen);
+    if(seen> 0){
+        uint64_t low= min.load(memory_order_relaxed);
+        uint64_t high= max.load(memory_order_relaxed);
+        fprintf(out, ",\"min\":%.3f,\"mean\":%.3f,\"max\":%.3f,\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"p999\":%.3f",
+            low/ 1000.0, total.load(memory_order_relaxed)/ 1000.0/ seen, high/ 1000.0,
+            percentile(counts, seen, 0.5, low, high)/ 1000.0, percentile(counts, seen, 0.9, low, high)/ 1000.0,
+            percentile(counts, seen, 0.99, low, high)/ 1000.0, percentile(counts, seen, 0.999, low, high)/ 1000.0);
+    }
+    fprintf(out, ",\"buckets\":[");
+    bool first= true;
+    for(int i= 0; i< HISTOGRAM_BUCKETS; i++){
+        if(counts[i]){
+            fprintf(out, "%s[%.3f,%llu]", first? "": ",", lowestIn(i)/ 1000.0, (unsigned long long)counts[i]);
+            first= false;
+        }
+    }
+    fprintf(out, "]}");
+}
+
+/*
+Always-on frame instrumentation
+Phases are timed with phaseTimer, framePresented measures the time between presents,
+jitter is how far that is from the 60 Hz period and a frame that took more than one and a half
+periods counts as a missed deadline
+*/
+class metrics{
+    public:
+        metrics(chrono::nanoseconds period): period(period){}
+        void framePresented();
+        void writeJson(FILE* out) const;
+        bool dump(char const* fileName) const;
+
+        histogram phases[PHASE_COUNT];
+        histogram frameTime;
+        histogram jitter;
+        uint64_t frames{};
+        uint64_t missed{};
+
+    private:
+        chrono::nanoseconds period;
+        chrono::steady_clock::time_point lastPresent;
+};
+
+void metrics::framePresented(){
+    auto now= chrono::steady_clock::now();
+    if(frames> 0){
+        int64_t nanos= chrono::duration_cast<chrono::nanoseconds>(now- lastPresent).count();
+        int64_t off= nanos- period.count();
+        frameTime.record(nanos);
+        jitter.record(off< 0? -off: off);
+        if(nanos* 2> period.count()* 3){
+            missed++;
+        }
+    }
+    lastPresent= now;
+    frames++;
+}
+
+void metrics::writeJson(FILE* out) const{
+    fprintf(out, "{\"frames\":%llu,\"missed\":%llu,\"frame_time\":", (unsigned long long)frames, (unsigned long long)missed);
+    frameTime.writeJson(out);
+    fprintf(out, ",\"jitter\":");
+    jitter.writeJson(out);
+    fprintf(out, ",\"phases\":{");
+    for(int i= 0; i< PHASE_COUNT; i++){
+        fprintf(out, "%s\"%s\":", i> 0? ",": "", PHASE_NAMES[i]);
+        phases[i].writeJson(out);
+    }
+    fprintf(out, "}}\n");
+}
+
+//"-" or an empty name is stderr, stdout stays clean for --record=-
+bool metrics::dump(char const* fileName) const{
+    if(fileName[0]== '\0' || (fileName[0]== '-' && fileName[1]== '\0')){
+        writeJson(stderr);
+        return true;
+    }
+    FILE* out= fopen(fileName, "w");
+    if(!out){
+        fprintf(stderr, "Could not open %s for writing\n", fileName);
+        return false;
+    }
+    writeJson(out);
+    fclose(out);
+    return true;
+}
+
+//times one phase for as long as it is in scope
+class phaseTimer{
+    public:
+        phaseTimer(metrics* stats, phase which): stats(stats), which(which), start(chrono::steady_clock::now()){}
+        ~phaseTimer(){
+            if(stats){
+                stats->phases[which].record(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now()- start).count());
+            }
+        }
+
+    private:
+        metrics* stats;
+        phase which;
+        chrono::steady_clock::time_point start;
+};
+
+//set by SIGUSR1, the main loop writes the JSON when it sees it
+volatile sig_atomic_t metricsDumpRequested= 0;
+
+void requestMetricsDump(int){
+    metricsDumpRequested= 1;
+}
+
+void installMetricsSignal(){
+#ifdef SIGUSR1
+    signal(SIGUSR1, requestMetricsDump);
+#endif
+}
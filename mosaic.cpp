@@ -0,0 +1,108 @@
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+/*
+One SDL window showing a grid of chip8 instances
+Every instance is written into its tile of one large streaming texture,
+so a frame is one lock/unlock, one copy and one SDL_RenderPresent however many instances there are
+*/
+class mosaic: public platform{
+    public:
+        mosaic(int columns, int rows, int scale);
+        void presentGrid(chip8* const* machines, int count);
+
+        int columns;
+        int rows;
+
+    private:
+        uint32_t expand[256][8]; //8 packed pixels to 8 texture pixels
+};
+
+mosaic::mosaic(int columns, int rows, int scale):
+    platform("Chip-8 mosaic", 64* columns* scale, 32* rows* scale, 64* columns, 32* rows), columns(columns), rows(rows){
+    for(int byte= 0; byte< 256; byte++){
+        for(int bit= 0; bit< 8; bit++){
+            expand[byte][bit]= (byte& (0x80>> bit))? 0xFFFFFFFF: 0xFF000000;
+        }
+    }
+}
+
+void mosaic::presentGrid(chip8* const* machines, int count){
+    void* pixels;
+    int pitch;
+
+    if(SDL_LockTexture(texture, nullptr, &pixels, &pitch)== 0){
+        for(int i= 0; i< count&& i< columns* rows; i++){
+            int tileX= (i% columns)* 64;
+            int tileY= (i/ columns)* 32;
+
+            for(int y= 0; y< 32; y++){
+                uint32_t* dst= (uint32_t*)((uint8_t*)pixels+ (tileY+ y)* pitch)+ tileX;
+                uint64_t bits= machines[i]->display[y];
+
+                for(int byte= 0; byte< 8; byte++){
+                    memcpy(dst+ byte* 8, expand[(bits>> (56- byte* 8)) & 0xFFu], sizeof(expand[0]));
+                }
+            }
+        }
+        SDL_UnlockTexture(texture);
+    }
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+    SDL_RenderPresent(renderer);
+}
+
+//runs columns x rows copies of the ROM, keyboard input goes to all of them
+int runMosaic(options const& opts){
+    mosaic window(opts.mosaicColumns, opts.mosaicRows, opts.videoScale);
+    if(!opts.keymapPath.empty()){
+        window.loadKeymap(opts.keymapPath.c_str());
+    }
+
+    int count= opts.mosaicColumns* opts.mosaicRows;
+    vector<unique_ptr<chip8>> instances;
+    vector<chip8*> machines;
+    for(int i= 0; i< count; i++){
+        instances.emplace_back(new chip8());
+        instances.back()->loadROM(opts.romFilename);
+        setupMachine(*instances.back(), opts);
+        machines.push_back(instances.back().get());
+    }
+
+    //one clock for the whole grid, every instance runs the same frame budget
+    scheduler clock(instructionsPerSecond(opts), !opts.virtualClock);
+    clock.vipTiming= opts.vipTiming;
+    pacer pace(opts.spinMicros, opts.jitterMicros);
+    bool quit= false;
+    uint64_t presented= 0;
+
+    while(!quit){
+        quit= window.input();
+        uint16_t keys= window.keymask.load(memory_order_relaxed);
+        uint64_t due= clock.framesDue();
+
+        for(uint64_t f= 0; f< due; f++){
+            int count= 0;
+            for(chip8* machine: machines){
+                machine->keypad= keys;
+                count= clock.execute(*machine);
+            }
+            clock.advance(count);
+        }
+        if(due> 0){
+            window.presentGrid(machines.data(), count);
+            presented++;
+            if(opts.maxFrames> 0 && presented>= (uint64_t)opts.maxFrames){
+                quit= true;
+            }
+        }
+        if(clock.wallClock&& !quit){
+            pace.waitUntil(clock.frameTime(clock.frame));
+        }
+    }
+    return 0;
+}
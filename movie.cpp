@@ -0,0 +1,278 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+const int DEFAULT_MOVIE_KEYFRAME_SECONDS= 10;
+
+/*
+Input movie, everything needed to replay a session bit for bit
+ 0  magic "C8MV"
+ 4  uint16 version
+ 6  uint8 quirk profile
+ 7  uint8 1 for VIP timing
+ 8  uint64 ROM hash
+16  uint32 RNG seed
+20  uint32 instructions per second
+24  uint32 frames between keyframes
+28  uint32 reserved, 0
+then records, each starting with a tag byte
+ 'K' keypad transition: LEB128 instruction count since the previous transition, uint16 keypad
+ 'S' keyframe: uint64 frame, uint64 instruction count, a save state (SAVE_STATE_SIZE bytes)
+ 'E' end: uint64 frame count, uint64 stateHash after the last frame
+A transition takes effect before the first instruction of the frame it is stamped with,
+a keyframe is the state at the start of its frame before any transition stamped there
+*/
+struct movieHeader{
+    char magic[4];
+    uint16_t version;
+    uint8_t quirks;
+    uint8_t vipTiming;
+    uint64_t romHash;
+    uint32_t seed;
+    uint32_t ips;
+    uint32_t keyframeFrames;
+    uint32_t reserved;
+};
+
+const uint16_t MOVIE_VERSION= 1;
+
+static_assert(sizeof(movieHeader)== 32, "movie header layout changed");
+
+//hash of a ROM file, a movie only replays on the ROM it was recorded with
+uint64_t hashFile(char const* fileName){
+    ifstream file(fileName, std::ios::binary);
+    uint64_t hash= 0x9E3779B97F4A7C15ull;
+    char chunk[8];
+    while(file.read(chunk, 8) || file.gcount()> 0){
+        uint64_t word= 0;
+        memcpy(&word, chunk, (size_t)file.gcount());
+        hash= mix64(hash^ word)+ (uint64_t)file.gcount();
+    }
+    return hash;
+}
+
+//records as the session runs, beginFrame is called before every frame
+class movieWriter{
+    public:
+        movieWriter(char const* fileName, movieHeader const& header);
+        ~movieWriter();
+        bool isOpen() const{ return out!= nullptr; }
+        void beginFrame(chip8 const& machine, scheduler const& clock);
+        void finish(chip8& machine, scheduler const& clock);
+
+        uint64_t transitions{};
+        uint64_t keyframes{};
+
+    private:
+        FILE* out;
+        uint32_t keyframeFrames;
+        uint64_t lastCycles{};
+        uint16_t lastKeys{};
+};
+
+movieWriter::movieWriter(char const* fileName, movieHeader const& header): keyframeFrames(header.keyframeFrames> 0? header.keyframeFrames: 1){
+    out= fopen(fileName, "wb");
+    if(!out){
+        cerr<<"Could not open "<<fileName<<" for writing\n";
+        return;
+    }
+    fwrite(&header, sizeof(header), 1, out);
+}
+
+movieWriter::~movieWriter(){
+    if(out){
+        fclose(out);
+    }
+}
+
+void movieWriter::beginFrame(chip8 const& machine, scheduler const& clock){
+    if(!out){
+        return;
+    }
+
+    if(clock.frame% keyframeFrames== 0){
+        uint8_t record[1+ 16+ SAVE_STATE_SIZE];
+        record[0]= 'S';
+        memcpy(record+ 1, &clock.frame, 8);
+        memcpy(record+ 9, &clock.cycles, 8);
+        machine.saveState(record+ 17, SAVE_STATE_SIZE);
+        fwrite(record, sizeof(record), 1, out);
+        keyframes++;
+    }
+
+    if(machine.keypad!= lastKeys || transitions== 0){
+        uint8_t record[1+ 10+ 2];
+        size_t size= 0;
+        record[size++]= 'K';
+        uint64_t delta= clock.cycles- lastCycles;
+        do{
+            record[size++]= (delta& 0x7F)| (delta> 0x7F? 0x80: 0);
+            delta>>= 7;
+        }while(delta);
+        memcpy(record+ size, &machine.keypad, 2);
+        size+= 2;
+        fwrite(record, size, 1, out);
+
+        lastCycles= clock.cycles;
+        lastKeys= machine.keypad;
+        transitions++;
+    }
+}
+
+//the end record lets a replay check it came out bit exact
+void movieWriter::finish(chip8& machine, scheduler const& clock){
+    if(!out){
+        return;
+    }
+    uint8_t record[1+ 16];
+    uint64_t hash= machine.stateHash();
+    record[0]= 'E';
+    memcpy(record+ 1, &clock.frame, 8);
+    memcpy(record+ 9, &hash, 8);
+    fwrite(record, sizeof(record), 1, out);
+    fclose(out);
+    out= nullptr;
+}
+
+//plays a movie back in place of the keyboard
+class moviePlayer{
+    public:
+        bool load(char const* fileName);
+        bool seek(chip8& machine, scheduler& clock, uint64_t frame);
+        void beginFrame(chip8& machine, scheduler const& clock);
+        bool finished(scheduler const& clock) const{ return ended&& clock.frame>= endFrame; }
+        bool verify(chip8& machine) const;
+
+        movieHeader header;
+
+    private:
+        struct transition{
+            uint64_t cycles;
+            uint16_t keys;
+        };
+        struct keyframe{
+            uint64_t frame;
+            uint64_t cycles;
+            size_t offset; //save state in data
+        };
+
+        vector<uint8_t> data;
+        vector<transition> transitions;
+        vector<keyframe> keyframes;
+        size_t next{}; //first transition not applied yet
+        uint16_t keys{}; //keypad as of the last applied transition
+        bool ended{};
+        uint64_t endFrame{};
+        uint64_t endHash{};
+};
+
+//reads the whole movie and indexes its records, a movie cut short (a crash) plays up to its last whole record
+bool moviePlayer::load(char const* fileName){
+    ifstream file(fileName, std::ios::binary | std::ios::ate);
+    if(!file.is_open()){
+        return false;
+    }
+    data.resize((size_t)file.tellg());
+    file.seekg(0, std::ios::beg);
+    file.read((char*)data.data(), data.size());
+
+    if(data.size()< sizeof(header)){
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    if(memcmp(header.magic, "C8MV", 4)!= 0 || header.version!= MOVIE_VERSION){
+        return false;
+    }
+
+    size_t at= sizeof(header);
+    uint64_t cycles= 0;
+    while(at< data.size()&& !ended){
+        uint8_t tag= data[at++];
+        if(tag== 'K'){
+            uint64_t delta= 0;
+            int shift= 0;
+            while(at< data.size()){
+                uint8_t byte= data[at++];
+                delta|= (uint64_t)(byte& 0x7F)<< shift;
+                shift+= 7;
+                if(!(byte& 0x80)){
+                    break;
+                }
+            }
+            if(at+ 2> data.size()){
+                break;
+            }
+            cycles+= delta;
+            transition t;
+            t.cycles= cycles;
+            memcpy(&t.keys, &data[at], 2);
+            at+= 2;
+            transitions.push_back(t);
+        }else if(tag== 'S'){
+            if(at+ 16+ SAVE_STATE_SIZE> data.size()){
+                break;
+            }
+            keyframe k;
+            memcpy(&k.frame, &data[at], 8);
+            memcpy(&k.cycles, &data[at+ 8], 8);
+            k.offset= at+ 16;
+            at+= 16+ SAVE_STATE_SIZE;
+            keyframes.push_back(k);
+        }else if(tag== 'E'){
+            if(at+ 16> data.size()){
+                break;
+            }
+            memcpy(&endFrame, &data[at], 8);
+            memcpy(&endHash, &data[at+ 8], 8);
+            ended= true;
+        }else{
+            return false;
+        }
+    }
+    return !keyframes.empty();
+}
+
+//restores the nearest keyframe at or before frame, then runs headless up to it
+bool moviePlayer::seek(chip8& machine, scheduler& clock, uint64_t frame){
+    size_t k= 0;
+    while(k+ 1< keyframes.size()&& keyframes[k+ 1].frame<= frame){
+        k++;
+    }
+    if(!machine.loadState(&data[keyframes[k].offset], SAVE_STATE_SIZE)){
+        return false;
+    }
+    clock.frame= keyframes[k].frame;
+    clock.cycles= keyframes[k].cycles;
+
+    //the keyframe already holds the keypad, transitions stamped at it still have to be applied
+    keys= machine.keypad;
+    next= 0;
+    while(next< transitions.size()&& transitions[next].cycles< clock.cycles){
+        next++;
+    }
+
+    while(clock.frame< frame&& !finished(clock)){
+        beginFrame(machine, clock);
+        clock.runFrame(machine);
+    }
+    clock.resync();
+    return true;
+}
+
+//the movie owns the keypad, whatever the host polled is overwritten
+void moviePlayer::beginFrame(chip8& machine, scheduler const& clock){
+    while(next< transitions.size()&& transitions[next].cycles<= clock.cycles){
+        keys= transitions[next].keys;
+        next++;
+    }
+    machine.keypad= keys;
+}
+
+bool moviePlayer::verify(chip8& machine) const{
+    return machine.stateHash()== endHash;
+}
@@ -0,0 +1,551 @@
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET socketHandle;
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int socketHandle;
+const socketHandle INVALID_SOCKET= -1;
+#endif
+
+using namespace std;
+
+const int NETPLAY_MAX_ROLLBACK= 12; //frames a peer may run on predicted input, 200 ms of round trip
+const int NETPLAY_INPUT_DELAY= 2; //local input is applied this many frames late, hides short round trips
+const int NETPLAY_RING= 64; //frames of snapshots and input kept, more than any window in flight
+const uint32_t NETPLAY_MAGIC= 0x504E3843; //"C8NP"
+const int NETPLAY_STALL_POLL_MICROS= 2000; //how often a stalled peer looks for the other's input
+const uint32_t NETPLAY_NO_HASH= 0xFFFFFFFF;
+const int NETPLAY_TEST_FRAMES= 1800;
+
+#ifdef _WIN32
+//winsock starts with the first socket and is cleaned up after the last, sockets are made on one thread
+int winsockUsers= 0;
+
+bool winsockAcquire(){
+    if(winsockUsers== 0){
+        WSADATA wsa;
+        if(WSAStartup(MAKEWORD(2, 2), &wsa)!= 0){
+            return false;
+        }
+    }
+    winsockUsers++;
+    return true;
+}
+
+void winsockRelease(){
+    winsockUsers--;
+    if(winsockUsers== 0){
+        WSACleanup();
+    }
+}
+#endif
+
+//non-blocking UDP socket talking to one peer, owns its handle so it cannot be copied
+class udpSocket{
+    public:
+        udpSocket(uint16_t localPort);
+        ~udpSocket();
+        udpSocket(udpSocket const&)= delete;
+        udpSocket& operator=(udpSocket const&)= delete;
+        bool isOpen() const{ return handle!= INVALID_SOCKET; }
+        uint16_t localPort() const;
+        bool connect(char const* host, uint16_t port);
+        void send(void const* data, size_t size);
+        int receive(void* data, size_t size);
+
+    private:
+        socketHandle handle= INVALID_SOCKET;
+        bool winsock{}; //holds a winsock reference, released even if the socket never opened
+};
+
+//0 picks a free port
+udpSocket::udpSocket(uint16_t localPort){
+#ifdef _WIN32
+    winsock= winsockAcquire();
+    if(!winsock){
+        return;
+    }
+#endif
+    handle= socket(AF_INET, SOCK_DGRAM, 0);
+    if(handle== INVALID_SOCKET){
+        return;
+    }
+
+    sockaddr_in address{};
+    address.sin_family= AF_INET;
+    address.sin_addr.s_addr= htonl(INADDR_ANY);
+    address.sin_port= htons(localPort);
+    if(bind(handle, (sockaddr*)&address, sizeof(address))!= 0){
+        cerr<<"Could not bind UDP port "<<localPort<<"\n";
+#ifdef _WIN32
+        closesocket(handle);
+#else
+        close(handle);
+#endif
+        handle= INVALID_SOCKET;
+        return;
+    }
+
+    //the session polls once per frame, it never waits on the network
+#ifdef _WIN32
+    u_long nonBlocking= 1;
+    ioctlsocket(handle, FIONBIO, &nonBlocking);
+#else
+    fcntl(handle, F_SETFL, fcntl(handle, F_GETFL, 0)| O_NONBLOCK);
+#endif
+}
+
+udpSocket::~udpSocket(){
+    if(handle!= INVALID_SOCKET){
+#ifdef _WIN32
+        closesocket(handle);
+#else
+        close(handle);
+#endif
+    }
+#ifdef _WIN32
+    if(winsock){
+        winsockRelease();
+    }
+#endif
+}
+
+uint16_t udpSocket::localPort() const{
+    sockaddr_in address{};
+    socklen_t size= sizeof(address);
+    getsockname(handle, (sockaddr*)&address, &size);
+    return ntohs(address.sin_port);
+}
+
+//sends go to the peer and only the peer's datagrams are received
+bool udpSocket::connect(char const* host, uint16_t port){
+    addrinfo hints{};
+    hints.ai_family= AF_INET;
+    hints.ai_socktype= SOCK_DGRAM;
+    addrinfo* found= nullptr;
+    if(getaddrinfo(host, to_string(port).c_str(), &hints, &found)!= 0 || !found){
+        cerr<<"Could not resolve "<<host<<"\n";
+        return false;
+    }
+    bool connected= ::connect(handle, found->ai_addr, (int)found->ai_addrlen)== 0;
+    freeaddrinfo(found);
+    return connected;
+}
+
+void udpSocket::send(void const* data, size_t size){
+    ::send(handle, (char const*)data, (int)size, 0);
+}
+
+//bytes received, 0 or less when nothing is waiting (or the peer is not up yet)
+int udpSocket::receive(void* data, size_t size){
+    return (int)recv(handle, (char*)data, (int)size, 0);
+}
+
+/*
+Datagram, sent every frame in both directions, little endian
+ 0  magic "C8NP"
+ 4  uint32 session, peers that would not run the same machine ignore each other
+ 8  uint32 ack, frames of the receiver's input the sender has
+12  uint32 first, frame of inputs[0]
+16  uint32 hash frame, the newest frame the sender has run on confirmed input only, NETPLAY_NO_HASH before its first
+20  uint16 count
+22  uint16 reserved, 0
+24  uint64 stateHash at the start of the hash frame
+32  uint16 keypad per frame, from first
+Every datagram repeats all input the peer has not acked, a lost one is covered by the next
+*/
+struct netplayPacket{
+    uint32_t magic;
+    uint32_t session;
+    uint32_t ack;
+    uint32_t first;
+    uint32_t hashFrame;
+    uint16_t count;
+    uint16_t reserved;
+    uint64_t hash;
+    uint16_t inputs[NETPLAY_RING];
+};
+
+static_assert(offsetof(netplayPacket, inputs)== 32, "netplay packet layout changed");
+
+//peers agree on this only when they start from the same machine with the same timing
+uint32_t netplaySessionId(chip8& machine, scheduler const& clock){
+    uint64_t hash= machine.stateHash();
+    hash= mix64(hash^ ((uint64_t)clock.ips<< 1 | (uint64_t)clock.vipTiming));
+    return (uint32_t)(hash^ (hash>> 32));
+}
+
+/*
+Two player rollback netplay, the keypad the machine sees is both players' keys ORed
+Every frame runs at once on the newest remote keys known (the prediction), its starting state is kept
+When the remote keys for a frame arrive and differ from what it ran with, the machine goes back to
+that frame's snapshot and runs forward again headless, all before the frame is shown
+A peer more than NETPLAY_MAX_ROLLBACK frames ahead of the other's input waits for it instead
+*/
+class netplaySession{
+    public:
+        netplaySession(udpSocket& link, uint32_t session, int inputDelay= NETPLAY_INPUT_DELAY);
+        bool advance(chip8& machine, scheduler& clock, uint16_t localKeys, chrono::steady_clock::time_point now);
+        void poll(chip8& machine, scheduler& clock, chrono::steady_clock::time_point now);
+        bool settled(scheduler const& clock) const;
+        void impair(int delayMillis, int jitterMillis, int lossPercent, uint32_t seed);
+        void report(FILE* out) const;
+
+        //measurements
+        uint64_t rollbacks{};
+        uint64_t resimulated{}; //frames run again
+        int maxDepth{};
+        float lastRollbackMicros{};
+        float maxRollbackMicros{};
+        uint64_t stalls{}; //frames held back waiting for the peer
+        uint64_t sent{};
+        uint64_t dropped{}; //by impair
+        uint64_t foreign{}; //from a peer with another session
+        uint64_t hashChecks{};
+        uint64_t desyncs{};
+
+    private:
+        struct frameSlot{
+            chip8State state; //at the start of the frame
+            uint64_t cycles;
+            uint64_t hash;
+            uint16_t remoteUsed; //remote keys the frame ran with
+        };
+        struct delayed{
+            chrono::steady_clock::time_point due;
+            vector<uint8_t> bytes;
+        };
+
+        void receive(uint64_t frame);
+        void rollback(chip8& machine, scheduler& clock);
+        void simulate(chip8& machine, scheduler& clock);
+        void send(scheduler const& clock, chrono::steady_clock::time_point now);
+        void checkPeerHash(scheduler const& clock);
+        uint16_t predictedRemote() const;
+
+        udpSocket& link;
+        uint32_t session;
+        int inputDelay;
+
+        vector<frameSlot> slots;
+        uint16_t localInputs[NETPLAY_RING]{};
+        uint16_t remoteInputs[NETPLAY_RING]{};
+        uint64_t remoteConfirmed{}; //frames of remote input received, in order
+        uint64_t localAcked{}; //frames of local input the peer has
+        uint64_t rollbackFrom= UINT64_MAX; //oldest frame that ran on a wrong prediction
+
+        uint64_t peerHashFrame{};
+        uint64_t peerHash{};
+        bool peerHashPending{};
+
+        //injected delay and loss for the test rig
+        int delayMillis{};
+        int jitterMillis{};
+        int lossPercent{};
+        uint32_t lossState{};
+        vector<delayed> outgoing;
+};
+
+netplaySession::netplaySession(udpSocket& link, uint32_t session, int inputDelay): link(link), session(session), inputDelay(inputDelay), slots(NETPLAY_RING){}
+
+//holds every datagram back by delay plus up to jitter and drops lossPercent of them
+void netplaySession::impair(int delay, int jitter, int loss, uint32_t seed){
+    delayMillis= delay;
+    jitterMillis= jitter;
+    lossPercent= loss;
+    lossState= seed| 1u;
+}
+
+//the remote player is assumed to still hold what they held last
+uint16_t netplaySession::predictedRemote() const{
+    return remoteConfirmed> 0? remoteInputs[(remoteConfirmed- 1)% NETPLAY_RING]: 0;
+}
+
+void netplaySession::receive(uint64_t frame){
+    netplayPacket packet;
+    int size;
+    while((size= link.receive(&packet, sizeof(packet)))> 0){
+        if(size< (int)offsetof(netplayPacket, inputs) || packet.magic!= NETPLAY_MAGIC
+            || size< (int)(offsetof(netplayPacket, inputs)+ packet.count* 2)){
+            continue;
+        }
+        if(packet.session!= session){
+            foreign++;
+            continue;
+        }
+
+        if(packet.ack> localAcked&& packet.ack<= frame+ inputDelay){
+            localAcked= packet.ack;
+        }
+
+        //take the inputs that continue the confirmed run, as far as there are slots free for them
+        for(uint16_t i= 0; i< packet.count; i++){
+            uint64_t at= (uint64_t)packet.first+ i;
+            if(at< remoteConfirmed){
+                continue;
+            }
+            if(at> remoteConfirmed || at+ NETPLAY_MAX_ROLLBACK+ 1>= frame+ NETPLAY_RING){
+                break;
+            }
+            uint16_t keys= packet.inputs[i];
+            remoteInputs[at% NETPLAY_RING]= keys;
+            if(at< frame&& slots[at% NETPLAY_RING].remoteUsed!= keys&& at< rollbackFrom){
+                rollbackFrom= at;
+            }
+            remoteConfirmed++;
+        }
+
+        //one hash at a time, kept until this side has run that frame on confirmed input too
+        if(packet.hashFrame!= NETPLAY_NO_HASH&& !peerHashPending&& packet.hashFrame> peerHashFrame){
+            peerHashFrame= packet.hashFrame;
+            peerHash= packet.hash;
+            peerHashPending= true;
+        }
+    }
+}
+
+//back to the first mispredicted frame and forward again to where the machine was
+void netplaySession::rollback(chip8& machine, scheduler& clock){
+    if(rollbackFrom>= clock.frame){
+        rollbackFrom= UINT64_MAX;
+        return;
+    }
+    auto start= chrono::steady_clock::now();
+
+    uint64_t target= clock.frame;
+    frameSlot const& slot= slots[rollbackFrom% NETPLAY_RING];
+    machine.restore(slot.state);
+    clock.frame= rollbackFrom;
+    clock.cycles= slot.cycles;
+    while(clock.frame< target){
+        simulate(machine, clock);
+    }
+
+    int depth= (int)(target- rollbackFrom);
+    rollbacks++;
+    resimulated+= depth;
+    maxDepth= depth> maxDepth? depth: maxDepth;
+    rollbackFrom= UINT64_MAX;
+
+    lastRollbackMicros= chrono::duration<float, micro>(chrono::steady_clock::now()- start).count();
+    if(lastRollbackMicros> maxRollbackMicros){
+        maxRollbackMicros= lastRollbackMicros;
+    }
+}
+
+//runs clock.frame on the inputs known for it, keeping its starting state to come back to
+void netplaySession::simulate(chip8& machine, scheduler& clock){
+    uint64_t frame= clock.frame;
+    frameSlot& slot= slots[frame% NETPLAY_RING];
+    slot.hash= machine.stateHash();
+    machine.snapshot(slot.state);
+    slot.cycles= clock.cycles;
+    slot.remoteUsed= frame< remoteConfirmed? remoteInputs[frame% NETPLAY_RING]: predictedRemote();
+
+    machine.keypad= localInputs[frame% NETPLAY_RING]| slot.remoteUsed;
+    clock.runFrame(machine);
+}
+
+//unacked local input and the hash of the newest frame that can no longer change
+void netplaySession::send(scheduler const& clock, chrono::steady_clock::time_point now){
+    uint64_t localKnown= clock.frame+ inputDelay;
+    netplayPacket packet{};
+    packet.magic= NETPLAY_MAGIC;
+    packet.session= session;
+    packet.ack= (uint32_t)remoteConfirmed;
+    packet.first= (uint32_t)localAcked;
+    packet.count= (uint16_t)(localKnown- localAcked);
+    for(uint16_t i= 0; i< packet.count; i++){
+        packet.inputs[i]= localInputs[(localAcked+ i)% NETPLAY_RING];
+    }
+    packet.hashFrame= NETPLAY_NO_HASH;
+    if(clock.frame> 0){
+        uint64_t final= remoteConfirmed< clock.frame- 1? remoteConfirmed: clock.frame- 1;
+        packet.hashFrame= (uint32_t)final;
+        packet.hash= slots[final% NETPLAY_RING].hash;
+    }
+    size_t size= offsetof(netplayPacket, inputs)+ packet.count* 2;
+    sent++;
+
+    if(delayMillis== 0&& jitterMillis== 0&& lossPercent== 0){
+        link.send(&packet, size);
+        return;
+    }
+
+    //xorshift32 decides loss and jitter, the rig is repeatable for a seed
+    lossState^= lossState<< 13;
+    lossState^= lossState>> 17;
+    lossState^= lossState<< 5;
+    if((int)(lossState% 100)< lossPercent){
+        dropped++;
+    }else{
+        delayed d;
+        int jitter= jitterMillis> 0? (int)((lossState>> 8)% (uint32_t)(jitterMillis+ 1)): 0;
+        d.due= now+ chrono::milliseconds(delayMillis+ jitter);
+        d.bytes.assign((uint8_t const*)&packet, (uint8_t const*)&packet+ size);
+        outgoing.push_back(d);
+    }
+
+    //jitter can reorder datagrams, as a real link would
+    for(size_t i= 0; i< outgoing.size();){
+        if(outgoing[i].due<= now){
+            link.send(outgoing[i].bytes.data(), outgoing[i].bytes.size());
+            outgoing.erase(outgoing.begin()+ i);
+        }else{
+            i++;
+        }
+    }
+}
+
+//both peers hash the same frame once neither can roll it back, a difference means they desynced
+void netplaySession::checkPeerHash(scheduler const& clock){
+    if(!peerHashPending|| peerHashFrame> remoteConfirmed || peerHashFrame+ 1> clock.frame){
+        return;
+    }
+    peerHashPending= false;
+    if(peerHashFrame+ NETPLAY_RING- NETPLAY_MAX_ROLLBACK< clock.frame){
+        return; //too old, the slot holds a newer frame
+    }
+    hashChecks++;
+    if(slots[peerHashFrame% NETPLAY_RING].hash!= peerHash){
+        if(desyncs== 0){
+            cerr<<"Netplay desync at frame "<<peerHashFrame<<"\n";
+        }
+        desyncs++;
+    }
+}
+
+//one frame forward, false when it has to wait for the peer (nothing ran)
+bool netplaySession::advance(chip8& machine, scheduler& clock, uint16_t localKeys, chrono::steady_clock::time_point now){
+    receive(clock.frame);
+    rollback(machine, clock);
+
+    uint64_t frame= clock.frame;
+    if(frame>= remoteConfirmed+ NETPLAY_MAX_ROLLBACK || frame+ inputDelay>= localAcked+ NETPLAY_RING){
+        stalls++;
+        send(clock, now);
+        checkPeerHash(clock);
+        return false;
+    }
+
+    localInputs[(frame+ inputDelay)% NETPLAY_RING]= localKeys;
+    simulate(machine, clock);
+    send(clock, now);
+    checkPeerHash(clock);
+    return true;
+}
+
+//keeps the link going without running a new frame
+void netplaySession::poll(chip8& machine, scheduler& clock, chrono::steady_clock::time_point now){
+    receive(clock.frame);
+    rollback(machine, clock);
+    send(clock, now);
+    checkPeerHash(clock);
+}
+
+//every frame run so far ran on the real remote input
+bool netplaySession::settled(scheduler const& clock) const{
+    return remoteConfirmed>= clock.frame&& rollbackFrom== UINT64_MAX;
+}
+
+void netplaySession::report(FILE* out) const{
+    fprintf(out, "Netplay: %llu rollbacks, %llu frames run again, deepest %d, last %.1f us, max %.1f us, %llu stalls, %llu sent, %llu dropped, %llu hash checks, %llu desyncs\n",
+        (unsigned long long)rollbacks, (unsigned long long)resimulated, maxDepth, lastRollbackMicros, maxRollbackMicros,
+        (unsigned long long)stalls, (unsigned long long)sent, (unsigned long long)dropped, (unsigned long long)hashChecks, (unsigned long long)desyncs);
+}
+
+//scripted player for the rig: holds one key, or none, for a few frames at a time
+uint16_t scriptedKeys(int player, uint64_t frame){
+    uint64_t roll= mix64((frame/ 9)* 2+ player+ 1);
+    int key= (int)(roll% 20);
+    return key< 16? (uint16_t)(1u<< key): 0;
+}
+
+/*
+Both peers in one process on localhost, every datagram delayed, jittered and sometimes dropped
+Time is simulated, each step is one 60 Hz frame of it but runs as fast as the host allows,
+the rollback timings are real and are what has to fit in a frame
+The peers must end with the same state hash, and the same one as a plain run on the real inputs
+*/
+int runNetplayTest(options const& opts){
+    udpSocket sockets[2]= {udpSocket(0), udpSocket(0)};
+    if(!sockets[0].isOpen() || !sockets[1].isOpen()
+        || !sockets[0].connect("127.0.0.1", sockets[1].localPort()) || !sockets[1].connect("127.0.0.1", sockets[0].localPort())){
+        cerr<<"Could not open the localhost sockets\n";
+        return EXIT_FAILURE;
+    }
+
+    uint64_t frames= opts.maxFrames> 0? (uint64_t)opts.maxFrames: NETPLAY_TEST_FRAMES;
+    uint32_t seed= opts.seeded? (opts.seed!= 0? opts.seed: 1u): (uint32_t)hashFile(opts.romFilename)| 1u;
+    chip8 machines[3];
+    vector<scheduler> clocks(3, scheduler(instructionsPerSecond(opts), false));
+    for(int i= 0; i< 3; i++){
+        machines[i].loadROM(opts.romFilename);
+        machines[i].rngState= seed;
+        machines[i].quirks= opts.wrapSprites? QUIRK_WRAP_SPRITES: 0;
+        clocks[i].vipTiming= opts.vipTiming;
+    }
+
+    uint32_t session= netplaySessionId(machines[0], clocks[0]);
+    netplaySession peers[2]= {netplaySession(sockets[0], session), netplaySession(sockets[1], session)};
+    int jitter= opts.netplayTestDelay/ 4;
+    for(int i= 0; i< 2; i++){
+        peers[i].impair(opts.netplayTestDelay, jitter, opts.netplayTestLoss, seed+ i);
+    }
+
+    //a peer done with its frames keeps the link up until the other has everything
+    auto now= chrono::steady_clock::now();
+    const auto step= chrono::nanoseconds(1000000000/ TIMER_HZ);
+    uint64_t steps= 0;
+    while(steps< frames* 4){
+        for(int i= 0; i< 2; i++){
+            if(clocks[i].frame< frames){
+                peers[i].advance(machines[i], clocks[i], scriptedKeys(i, clocks[i].frame), now);
+            }else{
+                peers[i].poll(machines[i], clocks[i], now);
+            }
+        }
+        steps++;
+        if(clocks[0].frame>= frames&& clocks[1].frame>= frames&& peers[0].settled(clocks[0])&& peers[1].settled(clocks[1])){
+            break;
+        }
+        now+= step;
+    }
+
+    //the reference sees each player's keys NETPLAY_INPUT_DELAY frames late, as the peers do
+    for(uint64_t f= 0; f< frames; f++){
+        machines[2].keypad= f< (uint64_t)NETPLAY_INPUT_DELAY? 0: scriptedKeys(0, f- NETPLAY_INPUT_DELAY)| scriptedKeys(1, f- NETPLAY_INPUT_DELAY);
+        clocks[2].runFrame(machines[2]);
+    }
+
+    printf("Netplay test: %llu frames, %d ms delay, %d ms jitter, %d%% loss, %llu steps\n",
+        (unsigned long long)frames, opts.netplayTestDelay, jitter, opts.netplayTestLoss, (unsigned long long)steps);
+    for(int i= 0; i< 2; i++){
+        printf("peer %d ", i+ 1);
+        peers[i].report(stdout);
+    }
+    printf("frame budget %.1f us\n", 1000000.0/ TIMER_HZ);
+
+    uint64_t hashes[3];
+    for(int i= 0; i< 3; i++){
+        hashes[i]= machines[i].stateHash();
+    }
+    bool converged= clocks[0].frame== frames&& clocks[1].frame== frames&& hashes[0]== hashes[1]&& hashes[0]== hashes[2];
+    printf("state %016llx %016llx reference %016llx: %s\n", (unsigned long long)hashes[0], (unsigned long long)hashes[1],
+        (unsigned long long)hashes[2], converged? "converged": "diverged");
+    return converged&& peers[0].desyncs== 0&& peers[1].desyncs== 0? 0: EXIT_FAILURE;
+}
@@ -0,0 +1,443 @@
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+//command line settings, positional <Scale> <Delay> <ROM> followed by --name[=value] flags
+struct options{
+    int videoScale{};
+    int cycleDelay{};
+    char const* romFilename{};
+
+    //CPU filter pipeline
+    bool filter{};
+    bool scanlines{};
+    bool grid{};
+    bool glow{};
+
+    //frame blending, needs the filter pipeline
+    blendMode blend= BLEND_NONE;
+    int blendFrames= 3;
+
+    //sdl, null, term or file (backendPath is the output file)
+    string backendName= "sdl";
+    string backendPath;
+    long maxFrames{}; //stop after this many presented frames, 0 runs until quit
+
+    //video recording, "-" is stdout
+    string recordPath;
+    bool recordY4m= true;
+    int recordScale= 1;
+
+    //PNG of the last frame and GIF of the whole run
+    string screenshotPath;
+    string clipPath;
+
+    //print the final display/state hash, optionally log the display hash of every frame
+    bool hash{};
+    string hashLog;
+
+    //grid of instances in one window, 0 runs a single instance
+    int mosaicColumns{};
+    int mosaicRows{};
+
+    //instructions per second, 0 derives it from <Delay> (ms per instruction)
+    int ips{};
+    bool virtualClock{}; //unthrottled and deterministic instead of synced to the wall clock
+    bool seeded{}; //seed the RNG from seed instead of the wall clock or the ROM
+    uint32_t seed{};
+    bool vipTiming{}; //COSMAC VIP cycle costs, ignores ips
+    bool wrapSprites{}; //QUIRK_WRAP_SPRITES, sprites wrap at the screen edges instead of being clipped
+
+    //frame pacing, microseconds
+    int spinMicros= DEFAULT_SPIN_MICROS;
+    int jitterMicros= DEFAULT_JITTER_MICROS;
+
+    //buzzer, SDL backend only
+    bool audio= true;
+    int audioBuffer= DEFAULT_AUDIO_BUFFER;
+    bool audioClock{}; //pace emulation by the audio device instead of the wall clock
+
+    //keyboard layout file for the SDL backend
+    string keymapPath;
+
+    //emulation on its own thread, frames handed to the render thread through a triple buffer
+    bool threaded{};
+
+    //frames run ahead of the shown one to hide input lag, 0 is off
+    int runahead{};
+
+    //frame timing histograms as JSON, written on exit and on SIGUSR1, "-" is stderr
+    string metricsPath;
+
+    //headless latency report for the ROM and any extra ROMs, comma separated
+    bool latency{};
+    string latencyRoms;
+
+    //machine state loaded before the first frame and saved after the last
+    string loadStatePath;
+    string saveStatePath;
+
+    //rewind history size in bytes, 0 turns it off, only kept for the SDL backend
+    size_t rewindBytes= DEFAULT_REWIND_BYTES;
+
+    //input movie recording and replay, seeking restores the nearest keyframe and runs headless from it
+    string moviePath;
+    string replayPath;
+    int movieKeyframeSeconds= DEFAULT_MOVIE_KEYFRAME_SECONDS;
+    double seekSeconds{};
+
+    //two player rollback netplay over UDP, 0 is off
+    int netplayPort{};
+    string netplayHost;
+    int netplayPeerPort{};
+
+    //both netplay peers in one process on localhost, datagrams delayed by netplayTestDelay ms and netplayTestLoss % dropped
+    bool netplayTest{};
+    int netplayTestDelay= 80;
+    int netplayTestLoss= 5;
+
+    //headless save state, rewind, movie and pool checks, the movie is replayed to a known hash
+    bool selfTest{};
+    string selfTestMovie;
+
+    //fast forward, turboFactor emulated frames per displayed frame, 0 is uncapped
+    bool turbo{};
+    int turboFactor{};
+};
+
+//the old <Delay> argument was milliseconds between instructions
+int instructionsPerSecond(options const& opts){
+    if(opts.ips> 0){
+        return opts.ips;
+    }
+    return opts.cycleDelay> 0? 1000/ opts.cycleDelay: DEFAULT_IPS;
+}
+
+//quirks and RNG seed of a freshly loaded machine, shared by the main window and the mosaic
+//--seed picks the seed, otherwise netplay and --virtual seed from the ROM and anything else keeps the wall clock
+void setupMachine(chip8& machine, options const& opts){
+    if(opts.wrapSprites){
+        machine.quirks|= QUIRK_WRAP_SPRITES;
+    }
+    if(opts.seeded){
+        machine.rngState= opts.seed!= 0? opts.seed: 1u;
+    }else if(opts.netplayPort> 0 || opts.virtualClock){
+        machine.rngState= (uint32_t)hashFile(opts.romFilename)| 1u;
+    }
+}
+
+//returns true if arg is --name or --name=value, value is left empty for the first form
+bool matchOption(char const* arg, char const* name, string& value){
+    size_t len= strlen(name);
+    if(strncmp(arg, "--", 2)!= 0 || strncmp(arg+ 2, name, len)!= 0){
+        return false;
+    }
+
+    char const* rest= arg+ 2+ len;
+    if(*rest== '\0'){
+        value.clear();
+        return true;
+    }
+    if(*rest== '='){
+        value= rest+ 1;
+        return true;
+    }
+    return false;
+}
+
+//value must be a whole number in [low, high], otherwise says so and returns false leaving out untouched
+template<typename T>
+bool parseNumber(string const& value, char const* name, long long low, long long high, T& out, int base= 10){
+    char* end= nullptr;
+    errno= 0;
+    long long parsed= strtoll(value.c_str(), &end, base);
+    if(value.empty() || isspace((unsigned char)value[0]) || *end!= '\0' || errno== ERANGE || parsed< low || parsed> high){
+        cerr<<name<<" must be a whole number from "<<low<<" to "<<high<<", not \""<<value<<"\"\n";
+        return false;
+    }
+    out= (T)parsed;
+    return true;
+}
+
+//value must be a finite number of seconds, 0 or more
+bool parseSeconds(string const& value, char const* name, double& out){
+    char* end= nullptr;
+    double parsed= strtod(value.c_str(), &end);
+    if(value.empty() || isspace((unsigned char)value[0]) || *end!= '\0' || !isfinite(parsed) || parsed< 0){
+        cerr<<name<<" must be a number of seconds, 0 or more, not \""<<value<<"\"\n";
+        return false;
+    }
+    out= parsed;
+    return true;
+}
+
+//comma separated list of filter stages, crt turns on all of them
+bool parseFilter(string const& list, options& opts){
+    opts.filter= true;
+    size_t start= 0;
+
+    while(start<= list.size()){
+        size_t end= list.find(',', start);
+        if(end== string::npos){
+            end= list.size();
+        }
+        string stage= list.substr(start, end- start);
+
+        if(stage== "crt"){
+            opts.scanlines= opts.grid= opts.glow= true;
+        }else if(stage== "scanlines"){
+            opts.scanlines= true;
+        }else if(stage== "grid"){
+            opts.grid= true;
+        }else if(stage== "glow"){
+            opts.glow= true;
+        }else if(stage!= "scale" && !stage.empty()){
+            cerr<<"Unknown filter stage: "<<stage<<"\n";
+            return false;
+        }
+        start= end+ 1;
+    }
+    return true;
+}
+
+//<mode>[:frames] where mode is none, or, decay or persist
+bool parseBlend(string const& value, options& opts){
+    size_t colon= value.find(':');
+    string mode= value.substr(0, colon);
+
+    if(mode== "none"){
+        opts.blend= BLEND_NONE;
+    }else if(mode== "or"){
+        opts.blend= BLEND_OR;
+    }else if(mode== "decay"){
+        opts.blend= BLEND_DECAY;
+    }else if(mode== "persist"){
+        opts.blend= BLEND_PERSIST;
+    }else{
+        cerr<<"Unknown blend mode: "<<mode<<"\n";
+        return false;
+    }
+
+    if(colon!= string::npos&& !parseNumber(value.substr(colon+ 1), "Blend frames", 1, MAX_BLEND_FRAMES, opts.blendFrames)){
+        return false;
+    }
+    if(opts.blend!= BLEND_NONE){
+        opts.filter= true;
+    }
+    return true;
+}
+
+//profiles set defaults, flags after them still win
+bool applyProfile(string const& name, options& opts){
+    if(name== "kiosk"){
+        opts.filter= true;
+        opts.scanlines= opts.grid= opts.glow= true;
+        opts.blend= BLEND_DECAY;
+        opts.blendFrames= 3;
+    }else if(name!= "default"){
+        cerr<<"Unknown profile: "<<name<<"\n";
+        return false;
+    }
+    return true;
+}
+
+//sdl, null, term or file:<path>
+bool parseBackend(string const& value, options& opts){
+    size_t colon= value.find(':');
+    opts.backendName= value.substr(0, colon);
+    opts.backendPath= colon== string::npos? "": value.substr(colon+ 1);
+
+    if(opts.backendName== "file" && opts.backendPath.empty()){
+        cerr<<"The file backend needs a path, --backend=file:<path>\n";
+        return false;
+    }
+    if(opts.backendName!= "sdl" && opts.backendName!= "null" && opts.backendName!= "term" && opts.backendName!= "file"){
+        cerr<<"Unknown backend: "<<opts.backendName<<"\n";
+        return false;
+    }
+    return true;
+}
+
+bool parseOptions(int argc, char** argv, options& opts){
+    if(argc< 4){
+        return false;
+    }
+
+    if(!parseNumber(argv[1], "<Scale>", 1, 64, opts.videoScale) || !parseNumber(argv[2], "<Delay>", 0, 1000, opts.cycleDelay)){
+        return false;
+    }
+    opts.romFilename= argv[3];
+
+    for(int i= 4; i< argc; i++){
+        string value;
+
+        if(matchOption(argv[i], "filter", value)){
+            if(!parseFilter(value, opts)){
+                return false;
+            }
+        }else if(matchOption(argv[i], "blend", value)){
+            if(!parseBlend(value, opts)){
+                return false;
+            }
+        }else if(matchOption(argv[i], "profile", value)){
+            if(!applyProfile(value, opts)){
+                return false;
+            }
+        }else if(matchOption(argv[i], "backend", value)){
+            if(!parseBackend(value, opts)){
+                return false;
+            }
+        }else if(matchOption(argv[i], "frames", value)){
+            if(!parseNumber(value, "--frames", 0, LONG_MAX, opts.maxFrames)){
+                return false;
+            }
+        }else if(matchOption(argv[i], "record", value)){
+            opts.recordPath= value.empty()? "-": value;
+        }else if(matchOption(argv[i], "record-format", value)){
+            if(value!= "y4m" && value!= "rgba"){
+                cerr<<"Unknown record format: "<<value<<"\n";
+                return false;
+            }
+            opts.recordY4m= value== "y4m";
+        }else if(matchOption(argv[i], "record-scale", value)){
+            if(!parseNumber(value, "--record-scale", 1, 64, opts.recordScale)){
+                return false;
+            }
+        }else if(matchOption(argv[i], "screenshot", value)){
+            opts.screenshotPath= value;
+        }else if(matchOption(argv[i], "clip", value)){
+            opts.clipPath= value;
+        }else if(matchOption(argv[i], "hash", value)){
+            opts.hash= true;
+        }else if(matchOption(argv[i], "hash-log", value)){
+            opts.hashLog= value.empty()? "-": value;
+        }else if(matchOption(argv[i], "mosaic", value)){
+            //<columns>x<rows>
+            size_t x= value.find('x');
+            if(x== string::npos){
+                cerr<<"Mosaic size must be <columns>x<rows>\n";
+                return false;
+            }
+            if(!parseNumber(value.substr(0, x), "Mosaic columns", 1, 16, opts.mosaicColumns)
+                || !parseNumber(value.substr(x+ 1), "Mosaic rows", 1, 16, opts.mosaicRows)){
+                return false;
+            }
+        }else if(matchOption(argv[i], "ips", value)){
+            if(!parseNumber(value, "--ips", 1, 10000000, opts.ips)){
+                return false;
+            }
+        }else if(matchOption(argv[i], "timing", value)){
+            if(value!= "vip" && value!= "ips"){
+                cerr<<"Unknown timing model: "<<value<<"\n";
+                return false;
+            }
+            opts.vipTiming= value== "vip";
+        }else if(matchOption(argv[i], "wrap-sprites", value)){
+            opts.wrapSprites= true;
+        }else if(matchOption(argv[i], "virtual", value)){
+            opts.virtualClock= true;
+        }else if(matchOption(argv[i], "seed", value)){
+            opts.seeded= true;
+            //decimal unless it starts with 0x, a leading zero is not octal
+            bool hex= value.size()> 1&& value[0]== '0'&& (value[1]== 'x' || value[1]== 'X');
+            if(!parseNumber(value, "--seed", 0, UINT32_MAX, opts.seed, hex? 16: 10)){
+                return false;
+            }
+        }else if(matchOption(argv[i], "spin", value)){
+            if(!parseNumber(value, "--spin", 0, MAX_SPIN_MICROS, opts.spinMicros)){
+                return false;
+            }
+        }else if(matchOption(argv[i], "jitter", value)){
+            if(!parseNumber(value, "--jitter", 0, MAX_SPIN_MICROS, opts.jitterMicros)){
+                return false;
+            }
+        }else if(matchOption(argv[i], "turbo", value)){
+            opts.turbo= true;
+            opts.turboFactor= 0;
+            if(!value.empty()&& !parseNumber(value, "--turbo", 0, 1000, opts.turboFactor)){
+                return false;
+            }
+        }else if(matchOption(argv[i], "no-audio", value)){
+            opts.audio= false;
+        }else if(matchOption(argv[i], "audio-buffer", value)){
+            if(!parseNumber(value, "--audio-buffer", 64, 32768, opts.audioBuffer)){
+                return false;
+            }
+        }else if(matchOption(argv[i], "audio-clock", value)){
+            opts.audioClock= true;
+        }else if(matchOption(argv[i], "keymap", value)){
+            opts.keymapPath= value;
+        }else if(matchOption(argv[i], "threaded", value)){
+            opts.threaded= true;
+        }else if(matchOption(argv[i], "runahead", value)){
+            if(!parseNumber(value, "--runahead", 0, 8, opts.runahead)){
+                return false;
+            }
+        }else if(matchOption(argv[i], "metrics", value)){
+            opts.metricsPath= value;
+        }else if(matchOption(argv[i], "latency", value)){
+            opts.latency= true;
+            opts.latencyRoms= value;
+        }else if(matchOption(argv[i], "load-state", value)){
+            opts.loadStatePath= value;
+        }else if(matchOption(argv[i], "save-state", value)){
+            opts.saveStatePath= value;
+        }else if(matchOption(argv[i], "rewind", value)){
+            if(!parseNumber(value, "--rewind", 0, 4096, opts.rewindBytes)){
+                return false;
+            }
+            opts.rewindBytes<<= 20;
+        }else if(matchOption(argv[i], "movie", value)){
+            opts.moviePath= value;
+        }else if(matchOption(argv[i], "movie-keyframes", value)){
+            if(!parseNumber(value, "--movie-keyframes", 1, 3600, opts.movieKeyframeSeconds)){
+                return false;
+            }
+        }else if(matchOption(argv[i], "replay", value)){
+            opts.replayPath= value;
+        }else if(matchOption(argv[i], "seek", value)){
+            if(!parseSeconds(value, "--seek", opts.seekSeconds)){
+                return false;
+            }
+        }else if(matchOption(argv[i], "netplay", value)){
+            //<local port>:<peer host>:<peer port>
+            size_t first= value.find(':');
+            size_t last= value.rfind(':');
+            if(first== string::npos || first== last){
+                cerr<<"Netplay needs --netplay=<local port>:<peer host>:<peer port>\n";
+                return false;
+            }
+            if(!parseNumber(value.substr(0, first), "Netplay local port", 1, 65535, opts.netplayPort)
+                || !parseNumber(value.substr(last+ 1), "Netplay peer port", 1, 65535, opts.netplayPeerPort)){
+                return false;
+            }
+            opts.netplayHost= value.substr(first+ 1, last- first- 1);
+        }else if(matchOption(argv[i], "self-test", value)){
+            opts.selfTest= true;
+            opts.selfTestMovie= value;
+        }else if(matchOption(argv[i], "netplay-test", value)){
+            //[<delay ms>[,<loss %>]]
+            opts.netplayTest= true;
+            if(!value.empty()){
+                size_t comma= value.find(',');
+                if(!parseNumber(value.substr(0, comma), "Netplay test delay", 0, 1000, opts.netplayTestDelay)){
+                    return false;
+                }
+                if(comma!= string::npos&& !parseNumber(value.substr(comma+ 1), "Netplay test loss", 0, 100, opts.netplayTestLoss)){
+                    return false;
+                }
+            }
+        }else{
+            cerr<<"Unknown option: "<<argv[i]<<"\n";
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,91 @@
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#ifdef __linux__
+#include <time.h>
+#endif
+
+using namespace std;
+
+#ifdef _WIN32
+const int DEFAULT_SPIN_MICROS= 2000; //Windows sleeps in whole timer ticks
+#else
+const int DEFAULT_SPIN_MICROS= 500;
+#endif
+const int DEFAULT_JITTER_MICROS= 100;
+const int MAX_SPIN_MICROS= 4000;
+
+/*
+Waits for the next frame deadline without pinning a core
+Sleeps until spin microseconds before the deadline, then spins the rest of the way
+If the OS wakes us later than the jitter target allows, the spin window grows to cover it,
+and it slowly shrinks back to the configured threshold when the sleeps are accurate
+*/
+class pacer{
+    public:
+        pacer(int spinMicros, int jitterMicros);
+        void waitUntil(chrono::steady_clock::time_point deadline);
+
+        int spinMicros; //configured spin threshold
+        int jitterMicros; //how late a wake up may be before the spin window grows
+
+        //measurements
+        int currentSpinMicros; //spin window in use after adapting
+        float lastLateMicros{}; //how far past the deadline the last wait returned
+        float maxLateMicros{};
+        uint64_t waits{};
+
+    private:
+        void sleepUntil(chrono::steady_clock::time_point wake);
+};
+
+pacer::pacer(int spinMicros, int jitterMicros): spinMicros(spinMicros), jitterMicros(jitterMicros), currentSpinMicros(spinMicros){}
+
+void pacer::sleepUntil(chrono::steady_clock::time_point wake){
+#ifdef __linux__
+    //steady_clock is CLOCK_MONOTONIC here, an absolute sleep does not drift with the call overhead
+    auto ns= chrono::duration_cast<chrono::nanoseconds>(wake.time_since_epoch()).count();
+    timespec target;
+    target.tv_sec= ns/ 1000000000;
+    target.tv_nsec= ns% 1000000000;
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &target, nullptr)!= 0){
+        //interrupted by a signal, go back to sleep
+    }
+#else
+    this_thread::sleep_until(wake);
+#endif
+}
+
+void pacer::waitUntil(chrono::steady_clock::time_point deadline){
+    auto now= chrono::steady_clock::now();
+    if(now>= deadline){
+        lastLateMicros= chrono::duration<float, micro>(now- deadline).count();
+        return;
+    }
+
+    auto wake= deadline- chrono::microseconds(currentSpinMicros);
+    if(now< wake){
+        sleepUntil(wake);
+
+        //adapt the spin window to how late the OS woke us
+        float overshoot= chrono::duration<float, micro>(chrono::steady_clock::now()- wake).count();
+        if(overshoot+ jitterMicros> currentSpinMicros){
+            currentSpinMicros= (int)overshoot+ jitterMicros;
+            if(currentSpinMicros> MAX_SPIN_MICROS){
+                currentSpinMicros= MAX_SPIN_MICROS;
+            }
+        }else if(currentSpinMicros> spinMicros){
+            currentSpinMicros-= (currentSpinMicros- spinMicros+ 15)/ 16;
+        }
+    }
+
+    while(chrono::steady_clock::now()< deadline){
+        //spin the last stretch
+    }
+
+    lastLateMicros= chrono::duration<float, micro>(chrono::steady_clock::now()- deadline).count();
+    if(lastLateMicros> maxLateMicros){
+        maxLateMicros= lastLateMicros;
+    }
+    waits++;
+}
@@ -1,20 +1,33 @@
 #include "src/include/SDL2/SDL.h"
 #include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
 
-class platform{
+//SDL backend: window, renderer and keyboard
+class platform: public backend{
     friend class Imgui;
 
     public:
         platform(char const* title, int windowWidth, int windowHeight, int textureWidth, int textureHeight);
         ~platform();
-        void update(void const* buffer, int pitch);
-        bool input(uint8_t* keys);
+        void present(uint64_t const* rows) override;
+        bool input() override;
+        bool loadKeymap(char const* fileName);
+        void audio(bool tone) override;
 
         SDL_Window* window{};
         SDL_GLContext gl_context{};
         unsigned int framebuffer_texture;
         SDL_Renderer* renderer{};
         SDL_Texture* texture{};
+        filter* screenFilter{}; //CPU filter used by present, the texture must be sized to its output
+        beeper* buzzer{}; //optional, gets an event whenever the tone turns on or off
+        metrics* stats{}; //optional, present times its convert, upload and present phases
+        bool toneOn{};
+
+        int keymap[SDL_NUM_SCANCODES]; //scancode to CHIP-8 key, -1 when unmapped
 
 };
 
@@ -24,6 +37,24 @@ platform::platform(char const* title, int windowWidth, int windowHeight, int tex
     window= SDL_CreateWindow(title, 0, 0, windowWidth, windowHeight, SDL_WINDOW_SHOWN);
     renderer= SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
     texture= SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, textureWidth, textureHeight);
+
+    //default layout, the left hand block of a QWERTY keyboard
+    //      1 2 3 4        1 2 3 C
+    //      Q W E R   ->   4 5 6 D
+    //      A S D F        7 8 9 E
+    //      Z X C V        A 0 B F
+    static const SDL_Scancode defaults[16]= {
+        SDL_SCANCODE_X, SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3,
+        SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_A,
+        SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_Z, SDL_SCANCODE_C,
+        SDL_SCANCODE_4, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_V
+    };
+    for(int& mapped: keymap){
+        mapped= -1;
+    }
+    for(int key= 0; key< 16; key++){
+        keymap[defaults[key]]= key;
+    }
 }
 
 //deconstructor
@@ -34,16 +65,43 @@ platform::~platform(){
     SDL_Quit();
 }
 
-void platform::update(void const* buffer, int pitch){
-    SDL_UpdateTexture(texture, nullptr, buffer, pitch);
-    SDL_RenderClear(renderer);
-    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+//run the packed display through the CPU filter straight into the texture
+void platform::present(uint64_t const* rows){
+    void* pixels;
+    int pitch;
+
+    bool locked;
+    {
+        phaseTimer timer(stats, PHASE_CONVERT);
+        locked= SDL_LockTexture(texture, nullptr, &pixels, &pitch)== 0;
+        if(locked){
+            screenFilter->run(rows, (uint32_t*)pixels, pitch);
+        }
+    }
+    {
+        phaseTimer timer(stats, PHASE_UPLOAD);
+        if(locked){
+            SDL_UnlockTexture(texture);
+        }
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+    }
+    phaseTimer timer(stats, PHASE_PRESENT);
     SDL_RenderPresent(renderer);
 }
 
-bool platform::input(uint8_t* keys){
+//only changes are posted, the beeper thread keeps playing the current state
+void platform::audio(bool tone){
+    if(buzzer&& tone!= toneOn){
+        buzzer->post(tone);
+    }
+    toneOn= tone;
+}
+
+bool platform::input(){
     bool quit= false;
     SDL_Event event;
+    uint16_t keys= keymask.load(memory_order_relaxed);
 
     while(SDL_PollEvent(&event)){
         switch(event.type){
@@ -52,145 +110,99 @@ bool platform::input(uint8_t* keys){
             } break;
 
             case SDL_KEYDOWN:{
+                int key= keymap[event.key.keysym.scancode];
+                if(key>= 0){
+                    keys|= 1u<< key;
+                }
+
                 switch(event.key.keysym.sym){
                     case SDLK_ESCAPE:{
-						quit = true;
-					} break;
-
-					case SDLK_x:{
-						keys[0] = 1;
-					} break;
-
-					case SDLK_1:{
-						keys[1] = 1;
-					} break;
-
-					case SDLK_2:{
-						keys[2] = 1;
-					} break;
-
-					case SDLK_3:{
-						keys[3] = 1;
-					} break;
-
-					case SDLK_q:{
-						keys[4] = 1;
-					} break;
+                        quit= true;
+                    } break;
 
-					case SDLK_w:{
-						keys[5] = 1;
-					} break;
+                    case SDLK_F12:{
+                        hotkeys|= HOTKEY_SCREENSHOT;
+                    } break;
 
-					case SDLK_e:{
-						keys[6] = 1;
-					} break;
+                    case SDLK_F11:{
+                        hotkeys|= HOTKEY_CLIP;
+                    } break;
 
-					case SDLK_a:{
-						keys[7] = 1;
-					} break;
+                    case SDLK_TAB:{
+                        hotkeys|= HOTKEY_TURBO;
+                    } break;
 
-					case SDLK_s:{
-						keys[8] = 1;
-					} break;
+                    case SDLK_F5:{
+                        hotkeys|= HOTKEY_SAVE_STATE;
+                    } break;
 
-					case SDLK_d:{
-						keys[9] = 1;
-					} break;
+                    case SDLK_F9:{
+                        hotkeys|= HOTKEY_LOAD_STATE;
+                    } break;
 
-					case SDLK_z:{
-						keys[0xA] = 1;
-					} break;
-
-					case SDLK_c:{
-						keys[0xB] = 1;
-					} break;
-
-					case SDLK_4:{
-						keys[0xC] = 1;
-					} break;
-
-					case SDLK_r:{
-						keys[0xD] = 1;
-					} break;
-
-					case SDLK_f:{
-						keys[0xE] = 1;
-					} break;
-
-					case SDLK_v:{
-						keys[0xF] = 1;
-					} break;
+                    case SDLK_BACKSPACE:{
+                        rewindHeld.store(true, memory_order_relaxed);
+                    } break;
                 }
             } break;
 
             case SDL_KEYUP:{
-                switch(event.key.keysym.sym){
-                    case SDLK_x:{
-						keys[0] = 0;
-					} break;
-
-					case SDLK_1:{
-						keys[1] = 0;
-					} break;
-
-					case SDLK_2:{
-						keys[2] = 0;
-					} break;
-
-					case SDLK_3:{
-						keys[3] = 0;
-					} break;
-
-					case SDLK_q:{
-						keys[4] = 0;
-					} break;
-
-					case SDLK_w:{
-						keys[5] = 0;
-					} break;
-
-					case SDLK_e:{
-						keys[6] = 0;
-					} break;
-
-					case SDLK_a:{
-						keys[7] = 0;
-					} break;
-
-					case SDLK_s:{
-						keys[8] = 0;
-					} break;
-
-					case SDLK_d:{
-						keys[9] = 0;
-					} break;
-
-					case SDLK_z:{
-						keys[0xA] = 0;
-					} break;
+                int key= keymap[event.key.keysym.scancode];
+                if(key>= 0){
+                    keys&= ~(1u<< key);
+                }
+                if(event.key.keysym.sym== SDLK_BACKSPACE){
+                    rewindHeld.store(false, memory_order_relaxed);
+                }
+            } break;
+        }
+    }
 
-					case SDLK_c:{
-						keys[0xB] = 0;
-					} break;
+    keymask.store(keys, memory_order_relaxed);
+    return quit;
+}
 
-					case SDLK_4:{
-						keys[0xC] = 0;
-					} break;
+/*
+Reads a keymap file, one mapping per line: <CHIP-8 key in hex> <SDL scancode name>
+        # the default left hand layout
+        1 1
+        C 4
+        A Z
+Keys that are not listed keep their default mapping
+*/
+bool platform::loadKeymap(char const* fileName){
+    ifstream file(fileName);
+    if(!file.is_open()){
+        cerr<<"Could not open keymap "<<fileName<<"\n";
+        return false;
+    }
 
-					case SDLK_r:{
-						keys[0xD] = 0;
-					} break;
+    string line;
+    while(getline(file, line)){
+        if(line.empty() || line[0]== '#'){
+            continue;
+        }
 
-					case SDLK_f:{
-						keys[0xE] = 0;
-					} break;
+        size_t space= line.find(' ');
+        if(space== string::npos){
+            continue;
+        }
+        string hex= line.substr(0, space);
+        char* end;
+        long key= strtol(hex.c_str(), &end, 16);
+        SDL_Scancode scancode= SDL_GetScancodeFromName(line.substr(space+ 1).c_str());
+        if(*end!= '\0' || key< 0 || key> 0xF || scancode== SDL_SCANCODE_UNKNOWN){
+            cerr<<"Bad keymap line: "<<line<<"\n";
+            continue;
+        }
 
-					case SDLK_v:{
-						keys[0xF] = 0;
-					} break;
-                }
-            }break;
+        //one host key per CHIP-8 key
+        for(int& mapped: keymap){
+            if(mapped== key){
+                mapped= -1;
+            }
         }
+        keymap[scancode]= key;
     }
-    return quit;
-}
\ No newline at end of file
+    return true;
+}
@@ -0,0 +1,56 @@
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+const size_t CLONE_POOL_BLOCK= 256; //machines allocated at a time, about 1.2 MB
+
+/*
+Recycled machines for searches that branch thousands of times per decision
+Machines come in blocks that live as long as the pool, so once it has grown to the widest point
+of a search a fork is a free list pop and one state copy, and a release is a push
+A new block is built straight from the state being forked, never default constructed (no ROM load or RNG seeding)
+Forks carry no observers, they are for looking ahead, not for showing, any added to one go on release
+Not thread safe, give each search thread its own pool
+*/
+class clonePool{
+    public:
+        clonePool(size_t blockSize= CLONE_POOL_BLOCK): blockSize(blockSize> 0? blockSize: 1){}
+        chip8* fork(chip8State const& from);
+        void release(chip8* machine);
+        size_t capacity() const{ return blocks.size()* blockSize; }
+        size_t inUse() const{ return capacity()- freeList.size(); }
+
+    private:
+        size_t blockSize;
+        vector<vector<chip8>> blocks; //reserved up front, so machines never move
+        vector<chip8*> freeList;
+};
+
+//a machine in the same state as from, a chip8 forks its own state
+chip8* clonePool::fork(chip8State const& from){
+    if(freeList.empty()){
+        blocks.emplace_back();
+        vector<chip8>& block= blocks.back();
+        block.reserve(blockSize);
+        for(size_t i= 0; i< blockSize; i++){
+            block.emplace_back(from);
+        }
+        for(size_t i= blockSize; i> 0; i--){
+            freeList.push_back(&block[i- 1]);
+        }
+        chip8* machine= freeList.back();
+        freeList.pop_back();
+        return machine;
+    }
+    chip8* machine= freeList.back();
+    freeList.pop_back();
+    machine->restore(from);
+    return machine;
+}
+
+//the machine goes back to the pool without any observers added to it, it must not be used after
+void clonePool::release(chip8* machine){
+    machine->clearObservers();
+    freeList.push_back(machine);
+}
@@ -0,0 +1,169 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+using namespace std;
+
+//frames the emulation thread can get ahead of the writer before frames are dropped
+const uint32_t RECORD_RING_FRAMES= 256;
+
+/*
+Streams every emulated frame (60 fps of emulated time) to a file or stdout ("-")
+Y4M (mono, 60 fps) can be piped straight into ffmpeg: chip8 ... --record=- | ffmpeg -i - out.mp4
+Raw RGBA writes bare ABGR8888 frames with no header
+push() only copies the packed frame into a single producer / single consumer ring,
+the writer thread does the conversion and all of the I/O
+*/
+class recorder{
+    public:
+        recorder(char const* fileName, bool y4m, int scale);
+        ~recorder();
+        void finish();
+        bool isOpen() const{ return out!= nullptr; }
+        void push(uint64_t const* rows);
+
+        atomic<uint64_t> written{};
+        atomic<uint64_t> dropped{}; //frames lost because the ring was full
+
+    private:
+        void writerLoop();
+        void convert(uint64_t const* rows);
+
+        struct frame{
+            uint64_t rows[32];
+        };
+
+        FILE* out{};
+        bool y4m;
+        int scale;
+        vector<uint8_t> image; //one converted frame, only touched by the writer
+
+        frame ring[RECORD_RING_FRAMES];
+        atomic<uint32_t> head{}; //next slot to fill, owned by push
+        atomic<uint32_t> tail{}; //next slot to write, owned by the writer
+        atomic<bool> running{true};
+        thread writer;
+};
+
+recorder::recorder(char const* fileName, bool y4m, int scale): y4m(y4m), scale(scale< 1? 1: scale){
+    if(strcmp(fileName, "-")== 0){
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        out= stdout;
+    }else{
+        out= fopen(fileName, "wb");
+    }
+
+    if(!out){
+        cerr<<"Could not open "<<fileName<<" for recording\n";
+        return;
+    }
+
+    int width= 64* this->scale;
+    int height= 32* this->scale;
+    image.resize(width* height* (y4m? 1: 4));
+
+    if(y4m){
+        fprintf(out, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 Cmono\n", width, height);
+    }
+    writer= thread(&recorder::writerLoop, this);
+}
+
+recorder::~recorder(){
+    finish();
+}
+
+//writes out whatever is still queued and closes the output
+void recorder::finish(){
+    running.store(false);
+    if(writer.joinable()){
+        writer.join();
+    }
+    if(out&& out!= stdout){
+        fclose(out);
+    }else if(out){
+        fflush(out);
+    }
+    out= nullptr;
+}
+
+//emulation side, never blocks
+void recorder::push(uint64_t const* rows){
+    if(!out){
+        return;
+    }
+
+    uint32_t h= head.load(memory_order_relaxed);
+    if(h- tail.load(memory_order_acquire)>= RECORD_RING_FRAMES){
+        dropped.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+
+    memcpy(ring[h% RECORD_RING_FRAMES].rows, rows, sizeof(ring[0].rows));
+    head.store(h+ 1, memory_order_release);
+}
+
+//packed bits to luma or RGBA, scaled
+void recorder::convert(uint64_t const* rows){
+    int width= 64* scale;
+    int bytes= y4m? 1: 4;
+
+    for(int y= 0; y< 32; y++){
+        uint8_t* line= &image[y* scale* width* bytes];
+
+        for(int x= 0; x< 64; x++){
+            uint8_t value= (rows[y]>> (63- x)) & 1u? 0xFF: 0x00;
+            uint8_t* px= line+ x* scale* bytes;
+
+            if(y4m){
+                memset(px, value, scale);
+            }else{
+                for(int s= 0; s< scale; s++){
+                    px[s* 4+ 0]= value;
+                    px[s* 4+ 1]= value;
+                    px[s* 4+ 2]= value;
+                    px[s* 4+ 3]= 0xFF;
+                }
+            }
+        }
+
+        for(int s= 1; s< scale; s++){
+            memcpy(line+ s* width* bytes, line, width* bytes);
+        }
+    }
+}
+
+void recorder::writerLoop(){
+    while(true){
+        uint32_t t= tail.load(memory_order_relaxed);
+
+        if(t== head.load(memory_order_acquire)){
+            //drain everything before stopping
+            if(!running.load()){
+                break;
+            }
+            this_thread::sleep_for(chrono::milliseconds(1));
+            continue;
+        }
+
+        convert(ring[t% RECORD_RING_FRAMES].rows);
+        tail.store(t+ 1, memory_order_release);
+
+        if(y4m){
+            fputs("FRAME\n", out);
+        }
+        fwrite(image.data(), 1, image.size(), out);
+        written.fetch_add(1, memory_order_relaxed);
+    }
+}
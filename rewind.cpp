@@ -0,0 +1,201 @@
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+const size_t DEFAULT_REWIND_BYTES= 4u<< 20; //about 10 minutes of a typical game
+const int REWIND_KEYFRAME_INTERVAL= 60; //frames between full snapshots
+const size_t STATE_WORDS= sizeof(chip8State)/ 8;
+
+static_assert(sizeof(chip8State)% 8== 0, "rewind deltas work on whole words");
+
+/*
+Rewind history, one entry per frame in a fixed size byte arena
+Each entry is the XOR of the frame's chip8State with the one before it, so stepping back is one XOR
+Every REWIND_KEYFRAME_INTERVAL frames the entry is the full state instead, that is where a step back
+has to rebuild forwards from the keyframe before it, and where eviction cuts when the arena is full
+Entries are run-length coded in words: a zero run, a literal count, then the literal words
+A frame usually changes a handful of words so the arena holds minutes of play in a few MB
+*/
+class rewindBuffer{
+    public:
+        rewindBuffer(size_t bytes);
+        void push(chip8State const& state);
+        bool stepBack(chip8& machine);
+        void report() const;
+
+        //measurements
+        float lastPushMicros{};
+        float maxPushMicros{};
+        uint64_t pushed{};
+        uint64_t pushedBytes{};
+
+    private:
+        struct entry{
+            size_t offset;
+            uint32_t size;
+            bool key;
+        };
+
+        uint32_t encode(uint64_t const* state, uint64_t const* previous);
+        void apply(entry const& e, uint64_t* state) const;
+        size_t allocate(uint32_t size);
+        void evictOldest();
+
+        vector<uint8_t> arena;
+        size_t writePos{};
+        deque<entry> entries;
+        int sinceKey{};
+
+        chip8State newest; //the state the last entry ends on
+        vector<uint8_t> staging;
+};
+
+rewindBuffer::rewindBuffer(size_t bytes): arena(bytes){
+    //worst case, every word literal in runs of one
+    staging.resize(STATE_WORDS* (8+ 4)+ 4);
+}
+
+//codes state ^ previous into staging, previous is null for a keyframe
+uint32_t rewindBuffer::encode(uint64_t const* state, uint64_t const* previous){
+    uint8_t* out= staging.data();
+    size_t i= 0;
+    while(i< STATE_WORDS){
+        uint16_t zeros= 0;
+        while(i< STATE_WORDS&& state[i]== (previous? previous[i]: 0)){
+            zeros++;
+            i++;
+        }
+        uint16_t literals= 0;
+        uint8_t* header= out;
+        out+= 4;
+        while(i< STATE_WORDS&& state[i]!= (previous? previous[i]: 0)){
+            uint64_t word= state[i]^ (previous? previous[i]: 0);
+            memcpy(out, &word, 8);
+            out+= 8;
+            literals++;
+            i++;
+        }
+        memcpy(header, &zeros, 2);
+        memcpy(header+ 2, &literals, 2);
+    }
+    return (uint32_t)(out- staging.data());
+}
+
+//XORs an entry onto state, a keyframe must be applied to zeros
+void rewindBuffer::apply(entry const& e, uint64_t* state) const{
+    uint8_t const* in= &arena[e.offset];
+    uint8_t const* end= in+ e.size;
+    size_t i= 0;
+    while(in< end){
+        uint16_t zeros, literals;
+        memcpy(&zeros, in, 2);
+        memcpy(&literals, in+ 2, 2);
+        in+= 4;
+        i+= zeros;
+        for(uint16_t n= 0; n< literals; n++, i++){
+            uint64_t word;
+            memcpy(&word, in, 8);
+            state[i]^= word;
+            in+= 8;
+        }
+    }
+}
+
+//a group without its keyframe cannot be rebuilt, so the oldest keyframe goes with its deltas
+void rewindBuffer::evictOldest(){
+    do{
+        entries.pop_front();
+    }while(!entries.empty()&& !entries.front().key);
+}
+
+//space for one entry, evicting the oldest history it runs into
+size_t rewindBuffer::allocate(uint32_t size){
+    if(writePos+ size> arena.size()){
+        //entries never wrap, the tail of the arena is the oldest history so it goes first
+        while(!entries.empty()&& entries.front().offset>= writePos){
+            evictOldest();
+        }
+        writePos= 0;
+    }
+    while(!entries.empty()&& entries.front().offset>= writePos&& entries.front().offset< writePos+ size){
+        evictOldest();
+    }
+
+    size_t offset= writePos;
+    writePos+= size;
+    return offset;
+}
+
+//called once per emulated frame
+void rewindBuffer::push(chip8State const& state){
+    auto start= chrono::steady_clock::now();
+
+    bool key= entries.empty()|| sinceKey>= REWIND_KEYFRAME_INTERVAL- 1;
+    uint32_t size= encode((uint64_t const*)&state, key? nullptr: (uint64_t const*)&newest);
+    if(size<= arena.size()){
+        entry e;
+        e.offset= allocate(size);
+        if(!key&& entries.empty()){
+            //the eviction took this delta's own keyframe, store a full frame instead
+            writePos= e.offset;
+            key= true;
+            size= encode((uint64_t const*)&state, nullptr);
+            e.offset= allocate(size);
+        }
+        e.size= size;
+        e.key= key;
+        memcpy(&arena[e.offset], staging.data(), size);
+        entries.push_back(e);
+        sinceKey= key? 0: sinceKey+ 1;
+        newest= state;
+        pushedBytes+= size;
+    }
+
+    pushed++;
+    lastPushMicros= chrono::duration<float, micro>(chrono::steady_clock::now()- start).count();
+    if(lastPushMicros> maxPushMicros){
+        maxPushMicros= lastPushMicros;
+    }
+}
+
+//puts the machine back one frame, false when the history is used up
+bool rewindBuffer::stepBack(chip8& machine){
+    if(entries.size()< 2){
+        return false;
+    }
+
+    entry last= entries.back();
+    entries.pop_back();
+    writePos= last.offset;
+
+    if(!last.key){
+        apply(last, (uint64_t*)&newest);
+        sinceKey--;
+    }else{
+        //rebuild forwards from the keyframe before
+        size_t key= entries.size()- 1;
+        while(!entries[key].key){
+            key--;
+        }
+        memset((void*)&newest, 0, sizeof(newest));
+        for(size_t i= key; i< entries.size(); i++){
+            apply(entries[i], (uint64_t*)&newest);
+        }
+        sinceKey= (int)(entries.size()- 1- key);
+    }
+
+    machine.restore(newest);
+    return true;
+}
+
+void rewindBuffer::report() const{
+    if(pushed> 0){
+        cerr<<"Rewind: "<<entries.size()<<" frames held, "<<pushedBytes/ pushed<<" bytes per frame, push "
+            <<lastPushMicros<<" us, max "<<maxPushMicros<<" us\n";
+    }
+}
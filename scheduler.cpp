@@ -0,0 +1,152 @@
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+const int TIMER_HZ= 60;
+const int DEFAULT_IPS= 700;
+
+//frames the wall clock may get ahead before the scheduler gives up catching up
+const uint64_t MAX_CATCH_UP_FRAMES= 10;
+
+/*
+Keeps a virtual clock for one chip8
+Emulated time is split into 60 Hz frames, each frame runs ips / 60 instructions
+(the remainder is spread so every second runs exactly ips) and then ticks the timers once
+wallClock - frames are released as real time passes, for interactive play
+virtual   - every call releases a frame, runs as fast as the host allows and is fully deterministic
+With vipTiming a frame instead runs until the COSMAC VIP cycle budget is spent (see vip.cpp)
+setRate stretches or shrinks the wall clock frame period, the audio clock uses it to follow the device
+*/
+class scheduler{
+    public:
+        scheduler(int ips, bool wallClock);
+        uint64_t framesDue();
+        void resync();
+        void setRate(double multiplier);
+        int runFrame(chip8& machine);
+        void runAhead(chip8& machine, int frames, chip8State& scratch, uint64_t* rows) const;
+        int execute(chip8& machine) const;
+        void advance(int count);
+        int instructionsFor(uint64_t frameNumber) const;
+        chrono::steady_clock::time_point frameTime(uint64_t frameNumber) const;
+
+        int ips;
+        bool wallClock;
+        bool vipTiming{}; //per-opcode VIP cycle costs instead of a flat ips
+        uint64_t frame{}; //frames run so far, the virtual clock
+        uint64_t cycles{}; //instructions run so far
+        double rate= 1.0; //frames per 1/60 s of wall clock
+
+    private:
+        chrono::steady_clock::time_point start; //wall clock time of frame startFrame
+        uint64_t startFrame{};
+};
+
+scheduler::scheduler(int ips, bool wallClock): ips(ips> 0? ips: DEFAULT_IPS), wallClock(wallClock){
+    start= chrono::steady_clock::now();
+}
+
+//instruction budget of a frame, depends only on the frame number so replays line up
+int scheduler::instructionsFor(uint64_t frameNumber) const{
+    return (int)((ips* (frameNumber+ 1))/ TIMER_HZ- (ips* frameNumber)/ TIMER_HZ);
+}
+
+//wall clock time a frame is due, frames before startFrame are not asked for
+chrono::steady_clock::time_point scheduler::frameTime(uint64_t frameNumber) const{
+    uint64_t frames= frameNumber- startFrame;
+    if(rate== 1.0){
+        return start+ chrono::nanoseconds(frames* 1000000000ull/ TIMER_HZ);
+    }
+    return start+ chrono::nanoseconds((int64_t)(frames* (1000000000.0/ TIMER_HZ)/ rate));
+}
+
+//makes the next frame due now, used after running off the wall clock (turbo)
+void scheduler::resync(){
+    start= chrono::steady_clock::now();
+    startFrame= frame;
+}
+
+//changes the frame period from the current frame on, frames already due stay due
+void scheduler::setRate(double multiplier){
+    start= frameTime(frame);
+    startFrame= frame;
+    rate= multiplier;
+}
+
+//how many frames should run now
+uint64_t scheduler::framesDue(){
+    if(!wallClock){
+        return 1;
+    }
+
+    auto now= chrono::steady_clock::now();
+    uint64_t due= 0;
+    while(frameTime(frame+ due)<= now){
+        due++;
+        if(due> MAX_CATCH_UP_FRAMES){
+            //too far behind (debugger, suspended process), slip the clock instead of racing
+            start= now;
+            startFrame= frame;
+            return 1;
+        }
+    }
+    return due;
+}
+
+//runs the current frame's instructions and its timer tick without moving the clock,
+//lets several machines share one clock
+int scheduler::execute(chip8& machine) const{
+    int count= 0;
+
+    if(vipTiming){
+        //spend the interpreter's share of the frame, Dxyn waits for vblank so it ends the frame
+        int budget= VIP_INTERPRETER_CYCLES;
+        while(budget> 0){
+            uint16_t pcBefore= machine.pc;
+            uint8_t spriteX= machine.registers[machine.memory[pcBefore& 0xFFFu] & 0x0Fu];
+            machine.FDEcycle();
+            count++;
+
+            int group= machine.opcode>> 12u;
+            bool skipGroup= group== 0x3 || group== 0x4 || group== 0x5 || group== 0x9 || group== 0xE;
+            budget-= vipCycles(machine.opcode, skipGroup&& machine.pc== pcBefore+ 4, spriteX);
+            if(group== 0xD){
+                break;
+            }
+        }
+    }else{
+        count= instructionsFor(frame);
+        for(int i= 0; i< count; i++){
+            machine.FDEcycle();
+        }
+    }
+
+    machine.tickTimers();
+    return count;
+}
+
+void scheduler::advance(int count){
+    cycles+= count;
+    frame++;
+}
+
+//one frame of emulated time: the instructions, then one 60 Hz timer tick
+int scheduler::runFrame(chip8& machine){
+    int count= execute(machine);
+    advance(count);
+    return count;
+}
+
+//run-ahead: runs the next frames on the current input, leaves their display in rows, then rolls back
+//the clock does not move and the extra frames are not seen by observers
+void scheduler::runAhead(chip8& machine, int frames, chip8State& scratch, uint64_t* rows) const{
+    machine.snapshot(scratch);
+    scheduler ahead= *this;
+    for(int i= 0; i< frames; i++){
+        ahead.runFrame(machine);
+    }
+    memcpy(rows, machine.display, sizeof(machine.display));
+    machine.restore(scratch);
+}
@@ -0,0 +1,185 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+const int SELF_TEST_FRAMES= 300; //frames run before and after each check
+const int SELF_TEST_REWIND_STEPS= 200; //crosses a few rewind keyframes
+const uint64_t SELF_TEST_MAX_REPLAY_FRAMES= 60* 60* 10; //a movie without an end record stops here
+const int SELF_TEST_POOL_FORKS= 100000;
+const uint32_t SELF_TEST_SEED= 0x2545F491;
+//stateHash at the end of Tetris.c8mv, only moves when the core or stateHash changes
+const uint64_t SELF_TEST_MOVIE_HASH= 0xdaf4fa2b10839ef8ull;
+
+/*
+Headless checks of the state machinery, make check runs them on Tetris.ch8 and Tetris.c8mv
+save state - a state saved mid game loads into a fresh machine with the same hash and both run on the same,
+             a state from another version is refused and leaves the machine as it was
+rewind     - every step back through the history lands on the hash recorded for that frame
+movie      - the movie replays to its own end hash and to SELF_TEST_MOVIE_HASH
+pool       - a pool fork and a clone run on the same as the original, a released fork keeps no observers
+One line per check on stdout, the exit code is non-zero if any failed
+*/
+
+//runs frames on player 1's keys from the netplay rig
+void selfTestRun(chip8& machine, scheduler& clock, int frames){
+    for(int i= 0; i< frames; i++){
+        machine.keypad= scriptedKeys(0, clock.frame);
+        clock.runFrame(machine);
+        machine.endFrame();
+    }
+}
+
+bool selfTestFail(char const* check, char const* why){
+    printf("%s: FAILED, %s\n", check, why);
+    return false;
+}
+
+bool selfTestSaveState(chip8 const& start, scheduler const& startClock){
+    chip8 machine= start.clone();
+    scheduler clock= startClock;
+    uint8_t buffer[SAVE_STATE_SIZE];
+    if(machine.saveState(buffer, sizeof(buffer))!= SAVE_STATE_SIZE){
+        return selfTestFail("save state", "could not save");
+    }
+
+    chip8 loaded;
+    scheduler loadedClock= clock;
+    if(!loaded.loadState(buffer, sizeof(buffer))|| loaded.stateHash()!= machine.stateHash()){
+        return selfTestFail("save state", "the loaded state hashes differently");
+    }
+    selfTestRun(machine, clock, SELF_TEST_FRAMES);
+    selfTestRun(loaded, loadedClock, SELF_TEST_FRAMES);
+    if(loaded.stateHash()!= machine.stateHash()){
+        return selfTestFail("save state", "the loaded machine diverged");
+    }
+
+    uint64_t before= loaded.stateHash();
+    buffer[offsetof(saveHeader, version)]^= 0xFF;
+    if(loaded.loadState(buffer, sizeof(buffer))|| loaded.stateHash()!= before){
+        return selfTestFail("save state", "a state from another version was loaded");
+    }
+
+    printf("save state: ok, %zu bytes, hash %016llx\n", SAVE_STATE_SIZE, (unsigned long long)machine.stateHash());
+    return true;
+}
+
+bool selfTestRewind(chip8 const& start, scheduler const& startClock){
+    chip8 machine= start.clone();
+    scheduler clock= startClock;
+    rewindBuffer history(DEFAULT_REWIND_BYTES);
+    vector<uint64_t> hashes;
+
+    history.push(machine);
+    hashes.push_back(machine.stateHash());
+    for(int i= 0; i< SELF_TEST_FRAMES; i++){
+        selfTestRun(machine, clock, 1);
+        history.push(machine);
+        hashes.push_back(machine.stateHash());
+    }
+
+    for(int step= 1; step<= SELF_TEST_REWIND_STEPS; step++){
+        if(!history.stepBack(machine)){
+            return selfTestFail("rewind", "the history ran out");
+        }
+        if(machine.stateHash()!= hashes[hashes.size()- 1- step]){
+            printf("rewind: FAILED, step %d back hashes differently\n", step);
+            return false;
+        }
+    }
+
+    printf("rewind: ok, %d steps back to %016llx\n", SELF_TEST_REWIND_STEPS, (unsigned long long)machine.stateHash());
+    return true;
+}
+
+bool selfTestMovie(string const& path, char const* rom){
+    moviePlayer replay;
+    if(!replay.load(path.c_str())){
+        return selfTestFail("movie", "could not read it");
+    }
+    if(replay.header.romHash!= hashFile(rom)){
+        return selfTestFail("movie", "it was recorded with a different ROM");
+    }
+
+    chip8 machine;
+    scheduler clock(replay.header.ips, false);
+    clock.vipTiming= replay.header.vipTiming;
+    if(!replay.seek(machine, clock, 0)){
+        return selfTestFail("movie", "its first keyframe does not load");
+    }
+    while(!replay.finished(clock)&& clock.frame< SELF_TEST_MAX_REPLAY_FRAMES){
+        replay.beginFrame(machine, clock);
+        clock.runFrame(machine);
+        machine.endFrame();
+    }
+
+    if(!replay.verify(machine)){
+        return selfTestFail("movie", "the replay diverged from the recording");
+    }
+    if(machine.stateHash()!= SELF_TEST_MOVIE_HASH){
+        printf("movie: FAILED, ended on %016llx instead of %016llx\n", (unsigned long long)machine.stateHash(),
+            (unsigned long long)SELF_TEST_MOVIE_HASH);
+        return false;
+    }
+
+    printf("movie: ok, %llu frames to %016llx\n", (unsigned long long)clock.frame, (unsigned long long)machine.stateHash());
+    return true;
+}
+
+bool selfTestPool(chip8 const& start, scheduler const& startClock){
+    clonePool pool(4);
+    chip8 machine= start.clone();
+    chip8* fork= pool.fork(machine);
+    chip8 copy= machine.clone();
+    scheduler clocks[3]= {startClock, startClock, startClock};
+    selfTestRun(machine, clocks[0], SELF_TEST_FRAMES);
+    selfTestRun(*fork, clocks[1], SELF_TEST_FRAMES);
+    selfTestRun(copy, clocks[2], SELF_TEST_FRAMES);
+    if(fork->stateHash()!= machine.stateHash()|| copy.stateHash()!= machine.stateHash()){
+        return selfTestFail("pool", "a fork diverged from the original");
+    }
+
+    //the next fork reuses the released machine, the observer must have gone with the release
+    int seen= 0;
+    fork->addObserver([&](frameChange const&){ seen++; });
+    pool.release(fork);
+    fork= pool.fork(start);
+    scheduler clock= startClock;
+    selfTestRun(*fork, clock, SELF_TEST_FRAMES);
+    pool.release(fork);
+    if(seen!= 0){
+        return selfTestFail("pool", "a released fork kept its observer");
+    }
+
+    auto begin= chrono::steady_clock::now();
+    for(int i= 0; i< SELF_TEST_POOL_FORKS; i++){
+        pool.release(pool.fork(machine));
+    }
+    double micros= chrono::duration<double, micro>(chrono::steady_clock::now()- begin).count()/ SELF_TEST_POOL_FORKS;
+
+    printf("pool: ok, fork and release %.3f us, %zu machines\n", micros, pool.capacity());
+    return true;
+}
+
+int runSelfTest(options const& opts){
+    chip8 start;
+    start.loadROM(opts.romFilename);
+    start.rngState= SELF_TEST_SEED;
+    scheduler startClock(instructionsPerSecond(opts), false);
+    startClock.vipTiming= opts.vipTiming;
+    selfTestRun(start, startClock, SELF_TEST_FRAMES);
+
+    bool ok= selfTestSaveState(start, startClock);
+    ok= selfTestRewind(start, startClock)&& ok;
+    if(opts.selfTestMovie.empty()){
+        printf("movie: skipped, no movie given\n");
+    }else{
+        ok= selfTestMovie(opts.selfTestMovie, opts.romFilename)&& ok;
+    }
+    ok= selfTestPool(start, startClock)&& ok;
+    return ok? 0: EXIT_FAILURE;
+}
@@ -0,0 +1,95 @@
+#include <cstdint>
+
+/*
+COSMAC VIP timing model
+Costs are in VIP machine cycles (8 clocks of the 1.7609 MHz CDP1802), so a 60 Hz frame is 3668 cycles
+The video DMA (128 lines x 8 bytes) and the interrupt routine use part of every frame,
+the rest is what the CHIP-8 interpreter gets
+Per-instruction figures follow the published analysis of the original interpreter and are approximate:
+every instruction pays the fetch/decode overhead, skips that are taken cost a little more,
+and Dxyn waits for the next vertical blank so it always ends the frame
+All tables are built at compile time, a lookup is one or two array reads
+*/
+
+const int VIP_CYCLES_PER_FRAME= 3668;
+const int VIP_DMA_CYCLES= 1024;
+const int VIP_INTERRUPT_CYCLES= 46;
+const int VIP_INTERPRETER_CYCLES= VIP_CYCLES_PER_FRAME- VIP_DMA_CYCLES- VIP_INTERRUPT_CYCLES;
+
+const int VIP_FETCH_CYCLES= 40; //fetch and decode, paid by every instruction
+const int VIP_SKIP_CYCLES= 4; //extra cost when a skip is taken
+
+struct vipTable{
+    uint16_t base[16]; //by the first nibble
+    uint16_t table0[16]; //00E0 and 00EE by the last nibble
+    uint16_t tableF[0x66]; //Fx.. by the last byte
+};
+
+constexpr vipTable makeVipTable(){
+    vipTable t{};
+
+    t.base[0x0]= 0; //filled from table0
+    t.base[0x1]= 12; //JP
+    t.base[0x2]= 26; //CALL
+    t.base[0x3]= 10; //SE Vx, byte
+    t.base[0x4]= 10; //SNE Vx, byte
+    t.base[0x5]= 14; //SE Vx, Vy
+    t.base[0x6]= 6; //LD Vx, byte
+    t.base[0x7]= 10; //ADD Vx, byte
+    t.base[0x8]= 44; //ALU ops all share the self-modifying code path
+    t.base[0x9]= 14; //SNE Vx, Vy
+    t.base[0xA]= 12; //LD I
+    t.base[0xB]= 22; //JP V0
+    t.base[0xC]= 36; //RND
+    t.base[0xD]= 26; //DRW, plus the per row cost below
+    t.base[0xE]= 14; //SKP/SKNP
+    t.base[0xF]= 0; //filled from tableF
+
+    t.table0[0x0]= 24+ 3054; //CLS clears 256 bytes of display memory
+    t.table0[0xE]= 10; //RET
+
+    t.tableF[0x07]= 10;
+    t.tableF[0x0A]= 10; //polling cost, the wait itself is the repeated instruction
+    t.tableF[0x15]= 10;
+    t.tableF[0x18]= 10;
+    t.tableF[0x1E]= 16;
+    t.tableF[0x29]= 16;
+    t.tableF[0x33]= 80+ 3* 16;
+    t.tableF[0x55]= 14; //plus 14 per register
+    t.tableF[0x65]= 14; //plus 14 per register
+
+    return t;
+}
+
+constexpr vipTable VIP_TABLE= makeVipTable();
+
+//cost of the instruction that just ran, skipped tells whether it skipped the next one
+inline int vipCycles(uint16_t opcode, bool skipped, uint8_t spriteX){
+    int group= opcode>> 12u;
+    int cost= VIP_FETCH_CYCLES+ VIP_TABLE.base[group];
+
+    switch(group){
+        case 0x0:{
+            cost+= VIP_TABLE.table0[opcode & 0x000Fu];
+        } break;
+
+        case 0xD:{
+            //rows that straddle a byte boundary have to be shifted across two bytes
+            int rows= opcode & 0x000Fu;
+            cost+= rows* ((spriteX & 7u)? 46: 34);
+        } break;
+
+        case 0xF:{
+            int low= opcode & 0x00FFu;
+            cost+= low< 0x66? VIP_TABLE.tableF[low]: 0;
+            if(low== 0x55 || low== 0x65){
+                cost+= 14* (((opcode & 0x0F00u)>> 8u)+ 1);
+            }
+        } break;
+    }
+
+    if(skipped){
+        cost+= VIP_SKIP_CYCLES;
+    }
+    return cost;
+}